@@ -0,0 +1,1264 @@
+/*
+ * ohash: the Optimal Hash string matching algorithms as a library.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * The kernels of the three SMART plugins only differ by the way they
+ * hash a q-gram into the shift table. Here a single skip loop, scan(),
+ * is instantiated for each hash family (and for each q for the shift-1
+ * family) so that the hash is unrolled as in the hand-written kernels,
+ * once with the sentinel of SMART and once guarded for read-only texts,
+ * each with and without the lookahead q-gram.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "ohash.h"
+#include "ohash_isa.h"
+
+
+
+#define ASIZE 256
+#define DSIGMA 65536
+#define WSIZE 256
+#define GOLDEN64 0x9E3779B97F4A7C15ULL
+// Verification work allowed per text byte before the Two-Way fallback
+#define GUARD 4
+#define GUARD_SLACK (1<<16)
+// First block searched by ohash_last()
+#define LAST_BLOCK (64<<10)
+// Longest shift of an absent q-gram for which the dispatcher adds the
+// lookahead q-gram to the skip loop
+#define LOOK_SHIFT 3
+// Cost of a stop of the pair scan in q-gram reads, for the choice of the
+// rare-byte engine
+#define RARE_STOP 4
+// Entries of a shift table: bytes while the shifts fit, 16 bits above,
+// where the longer shifts are cut to SHIFT16, which is still safe
+#define WIDTH(sh0) ((sh0) <= UCHAR_MAX ? 1 : 2)
+#define SHIFT16 USHRT_MAX
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+
+// Key of the q-gram starting at s for q > 10: the q bytes are read as
+// (overlapping) 64-bit words, mixed and folded to a DSIGMA index
+static ALWAYS_INLINE unsigned int HQ(unsigned char *s, int q) {
+  unsigned long long h, w;
+  int k;
+
+  h = 0;
+  for (k = 0; k < q-8; k += 8) {
+    memcpy(&w, s+k, 8);
+    h = (h ^ w) * GOLDEN64;
+  }
+  memcpy(&w, s+q-8, 8);
+  h = (h ^ w) * GOLDEN64;
+  return (unsigned int)(h>>48);
+}
+
+// Memory of a compiled pattern: the heap, or the workspace of the caller
+// when base is set, where pieces are cut at cache line boundaries
+struct arena {
+  unsigned char *base;
+  size_t size;
+  size_t used;
+};
+
+#define LINE 64
+#define ALIGNED(len) (((len)+LINE-1) & ~(size_t)(LINE-1))
+
+static void *take(struct arena *a, size_t len) {
+  void *r;
+
+  if (a->base == NULL) return malloc(len);
+  len = ALIGNED(len);
+  if (len > a->size-a->used) return NULL;
+  r = a->base+a->used;
+  a->used += len;
+  return r;
+}
+
+// Arena over a workspace, from its first cache line boundary
+static int inWorkspace(struct arena *a, void *ws, size_t size) {
+  size_t skip;
+
+  skip = (LINE - (size_t)ws%LINE) % LINE;
+  if (ws == NULL || size < skip) return -1;
+  a->base = (unsigned char *)ws+skip;
+  a->size = size-skip;
+  a->used = 0;
+  return 0;
+}
+
+// Scratch memory is given back in the reverse order
+static void drop(struct arena *a, void *r, size_t mark) {
+  if (a->base == NULL) free(r);
+  else a->used = mark;
+}
+
+// Structure to store information of a suffix
+struct suffix {
+  int index;
+  int len;
+  unsigned char *suff;
+};
+
+// Lexicographic order of two suffixes, which may contain any byte
+static int cmp(const void *a, const void *b) {
+  const struct suffix *u = a, *v = b;
+  int r;
+
+  r = memcmp(u->suff, v->suff, MIN(u->len, v->len));
+  if (r != 0) return r;
+  return u->len - v->len;
+}
+
+// In-place heap sort, qsort() may allocate
+static void sortSuffixes(struct suffix *a, int m) {
+  struct suffix t;
+  int i, j, k, end;
+
+  for (end = m, i = m/2-1; end > 1; ) {
+    if (i >= 0) {
+      k = i--;
+    }
+    else {
+      --end;
+      t = a[0];
+      a[0] = a[end];
+      a[end] = t;
+      k = 0;
+    }
+    // sift a[k] down in a[0..end-1]
+    while ((j = 2*k+1) < end) {
+      if (j+1 < end && cmp(&a[j+1], &a[j]) > 0) ++j;
+      if (cmp(&a[k], &a[j]) >= 0) break;
+      t = a[k];
+      a[k] = a[j];
+      a[j] = t;
+      k = j;
+    }
+  }
+}
+
+// Length of the longest factor occurring at least twice in x, from the
+// suffix array and the LCP of consecutive suffixes (Kasai et al.).
+// Returns -1 if out of memory
+static int maxRepeat(struct arena *a, unsigned char *x, int m) {
+  struct suffix *suffixes;
+  int *ISA, j, r, ell, res;
+  size_t mark;
+
+  mark = a->used;
+  suffixes = (struct suffix *)take(a, m*sizeof(struct suffix));
+  ISA = (int *)take(a, m*sizeof(int));
+  if (suffixes == NULL || ISA == NULL) {
+    if (ISA != NULL) drop(a, ISA, mark);
+    if (suffixes != NULL) drop(a, suffixes, mark);
+    return -1;
+  }
+  for (j = 0; j < m; j++) {
+    suffixes[j].index = j;
+    suffixes[j].len = m-j;
+    suffixes[j].suff = x+j;
+  }
+  sortSuffixes(suffixes, m);
+  for (r = 0; r < m; r++)
+    ISA[suffixes[r].index] = r;
+
+  ell = 0;
+  res = 0;
+  for (j = 0; j < m; j++) {
+    ell = MAX(0, ell-1);
+    if (ISA[j] > 0) {
+      r = suffixes[ISA[j]-1].index;
+      while (MAX(j, r)+ell < m && x[j+ell] == x[r+ell])
+        ell++;
+    }
+    else {
+      ell = 0;
+    }
+    if (ell > res) res = ell;
+  }
+  drop(a, ISA, mark);
+  drop(a, suffixes, mark);
+  return res;
+}
+
+// Alphabet reduction: ranks the distinct symbols of x densely from 1,
+// every symbol absent from x goes to class 0. Returns the number of
+// bits needed to store one class
+static int buildRanks(unsigned char *x, int m, unsigned char *rank) {
+  int i, d, b;
+
+  memset(rank, 0, ASIZE);
+  d = 0;
+  for (i = 0; i < m; ++i)
+    if (rank[x[i]] == 0) rank[x[i]] = ++d;
+  b = 1;
+  while ((1<<b) < d+1) ++b;
+  return b;
+}
+
+
+// Slot in the shift table of the q-gram ending at s. q is a constant
+// in the unrolled kernels, 0 means it is read from p
+static ALWAYS_INLINE unsigned int slot(ohash_pattern *p, unsigned char *s, int kernel, int q) {
+  unsigned int h;
+  unsigned char c;
+  int k;
+
+  if (q == 0) q = p->q;
+  switch (kernel) {
+    case OHASH_K_BYTE :
+      return s[0];
+    case OHASH_K_SHL1 :
+      h = s[1-q];
+      for (k = q-2; k >= 0; --k)
+        h = ((h<<1) + s[-k]);
+      return h%DSIGMA;
+    case OHASH_K_SHL8 :
+      return (s[-1]<<8) + s[0];
+    case OHASH_K_RANK :
+      h = p->rank[s[1-q]];
+      for (k = q-2; k >= 0; --k)
+        h = ((h<<p->b) | p->rank[s[-k]]);
+      return h;
+    case OHASH_K_TWO3 :
+      return p->slot[(s[-1]<<8) | s[0]]*ASIZE + s[-2];
+    case OHASH_K_HASH3 :
+      c = s[-2];
+      c = ((c<<1) + s[-1]);
+      c = ((c<<1) + s[0]);
+      return c;
+    case OHASH_K_HASH8 :
+      h = s[-7];
+      for (k = 6; k >= 0; --k)
+        h = ((h<<1) + s[-k]);
+      return h%WSIZE;
+    default :
+      return HQ(s+1-q, q);
+  }
+}
+
+// Entry h of the shift table of p
+static ALWAYS_INLINE int entry(ohash_pattern *p, unsigned int h, int width) {
+  if (width == 1) return ((unsigned char *)p->shift)[h];
+  return ((unsigned short *)p->shift)[h];
+}
+
+static void setEntry(ohash_pattern *p, unsigned int h, int v) {
+  if (p->width == 1) ((unsigned char *)p->shift)[h] = v;
+  else ((unsigned short *)p->shift)[h] = MIN(v, SHIFT16);
+}
+
+// Shift for the window ending at s
+static ALWAYS_INLINE int shiftOf(ohash_pattern *p, unsigned char *s, int kernel, int q, int width) {
+  unsigned int h;
+
+  if (kernel == OHASH_K_TWO3) {
+    h = (s[-1]<<8) | s[0];
+    if (!(p->bits[h>>5] & (1U<<(h&31))))
+      return p->sh0;
+  }
+  return entry(p, slot(p, s, kernel, q), width);
+}
+
+// Maximal suffix of x for the order < (rev = 0) or > (rev = 1), and its
+// period
+static int maxSuffix(unsigned char *x, int m, int *per, int rev) {
+  int ms, j, k, p;
+  unsigned char a, b;
+
+  ms = -1;
+  j = 0;
+  k = p = 1;
+  while (j+k < m) {
+    a = x[j+k];
+    b = x[ms+k];
+    if (rev ? a > b : a < b) {
+      j += k;
+      k = 1;
+      p = j-ms;
+    }
+    else if (a == b) {
+      if (k != p) ++k;
+      else {
+        j += p;
+        k = 1;
+      }
+    }
+    else {
+      ms = j;
+      j = ms+1;
+      k = p = 1;
+    }
+  }
+  *per = p;
+  return ms;
+}
+
+// Critical factorization of x for the Two-Way fallback
+static void factorize(ohash_pattern *p) {
+  int i, j, p1, p2;
+
+  i = maxSuffix(p->x, p->m, &p1, 0);
+  j = maxSuffix(p->x, p->m, &p2, 1);
+  if (i > j) {
+    p->ell = i;
+    p->per = p1;
+  }
+  else {
+    p->ell = j;
+    p->per = p2;
+  }
+  p->periodic = p->per+p->ell+1 <= p->m && memcmp(p->x, p->x+p->per, p->ell+1) == 0;
+  if (!p->periodic) p->per = MAX(p->ell+1, p->m-p->ell-1)+1;
+}
+
+// Two-Way (Crochemore and Perrin) from window start, in O(n) time and
+// constant space: the fallback of the kernels when verifications cost
+// too much. Same contract as the guarded loop
+static int twoWay(ohash_pattern *p, unsigned char *y, int n, int start,
+                  ohash_report report, void *ctx, long long base) {
+  unsigned char *x;
+  int count, i, j, m, ell, per, memory;
+  long long next;
+
+  x = p->x;
+  m = p->m;
+  ell = p->ell;
+  per = p->per;
+  count = 0;
+  memory = -1;
+  j = start;
+  while (j <= n-m) {
+    i = p->periodic ? MAX(ell, memory)+1 : ell+1;
+    while (i < m && x[i] == y[i+j]) ++i;
+    if (i < m) {
+      j += i-ell;
+      memory = -1;
+      continue;
+    }
+    i = ell;
+    while (i > memory && x[i] == y[i+j]) --i;
+    if (i <= memory) {
+      ++count;
+      if (report != NULL) {
+        next = report(ctx, base+j);
+        if (next < 0) return count;
+        next -= base;
+        if (next > j+per) {
+          j = (int)MIN(next, n);
+          memory = -1;
+          continue;
+        }
+      }
+    }
+    j += per;
+    memory = p->periodic ? m-per-1 : -1;
+  }
+  return count;
+}
+
+// Verification of the window starting at w. The positions chosen by
+// ohash_order() come first, then the first and last 8 bytes
+// to verify are compared as words with those of x, which rejects most of
+// the windows let through by a hash with collisions in two loads; the
+// bytes between them are compared only if both agree
+static ALWAYS_INLINE int verifyWindow(ohash_pattern *p, unsigned char *w) {
+  unsigned long long a, b;
+  int k, vlen;
+
+  for (k = 0; k < p->probes; ++k)
+    if (w[p->probe[k]] != p->x[p->probe[k]]) return 0;
+  vlen = p->vlen;
+  if (vlen < 8) return VERIFY(p->x, w, vlen);
+  memcpy(&a, w, 8);
+  memcpy(&b, w+vlen-8, 8);
+  if (((a ^ p->head) | (b ^ p->tail)) != 0) return 0;
+  return vlen <= 16 || VERIFY(p->x+8, w+8, vlen-16);
+}
+
+// The skip loop shared by all kernels. A guarded loop checks the end of
+// the text at each shift and never writes y, otherwise the pattern is
+// copied after y[n-1] to stop the loop. With look, as in Quick Search
+// and Berry-Ravindran, the q-gram ending just after the window gives a
+// second shift, one more than its entry in the same table, and the
+// longer one is taken. width is that of the table. Indices are int, the
+// callers split longer texts; base is the offset of y passed to report
+static ALWAYS_INLINE int scan(ohash_pattern *p, unsigned char *y, int n, int kernel, int q,
+                              int width, int look, int guarded,
+                              ohash_report report, void *ctx, long long base) {
+  unsigned char *x;
+  int count, i, sh, sh1, mMinus1, vlen, post, overlap, known, from;
+  long long next, work;
+
+  x = p->x;
+  count = 0;
+  work = 0;
+  mMinus1 = p->m-1;
+  sh1 = p->sh1;
+  vlen = p->vlen;
+  // after a match: no occurrence starts before the next period, and when
+  // per is the period of x the next window already matches up to m-per
+  post = MAX(sh1, p->per);
+  overlap = p->periodic ? p->m-p->per : 0;
+  known = -1;
+  if (!guarded)
+    memcpy(y+n, x, p->m);
+  i = mMinus1;
+  while (1) {
+    sh = 1;
+    while (sh != 0) {
+      if (guarded && i >= n) return count;
+      sh = shiftOf(p, y+i, kernel, q, width);
+      if (look && sh != 0 && (!guarded || i+1 < n))
+        sh = MAX(sh, shiftOf(p, y+i+1, kernel, q, width)+1);
+      i += sh;
+    }
+    if (i >= n) return count;
+    // bytes compared so far, bounded by a multiple of the text scanned
+    from = 0;
+    if (i == known) from = overlap;
+    work += vlen-from;
+    if (work > GUARD*(long long)i + GUARD_SLACK)
+      return count + twoWay(p, y, n, i-mMinus1, report, ctx, base);
+    if (from == 0 ? verifyWindow(p, y+i-mMinus1)
+                  : from >= vlen || VERIFY(x+from, y+i-mMinus1+from, vlen-from)) {
+      ++count;
+      if (report != NULL) {
+        next = report(ctx, base+i-mMinus1);
+        if (next < 0) return count;
+        next = MIN(next-base, n);
+        if (next+mMinus1 > i+post) {
+          i = (int)next+mMinus1;
+          continue;
+        }
+      }
+      i += post;
+      known = i;
+    }
+    else {
+      i += sh1;
+    }
+  }
+}
+
+// The rare-byte engine: the windows holding the two rarest bytes of x at
+// their offsets are found by the SIMD scan of ohash_isa.h and verified
+// in full, without the skip loop. Same guard and shift after a match as
+// scan(); y is never written
+static int rareScan(ohash_pattern *p, unsigned char *y, int n,
+                    ohash_report report, void *ctx, long long base) {
+  unsigned char *x;
+  int count, s, last, m, o1, o2, c1, c2, post;
+  long long next, work;
+
+  x = p->x;
+  m = p->m;
+  o1 = p->o1;
+  o2 = p->o2;
+  c1 = x[o1];
+  c2 = x[o2];
+  post = MAX(1, p->per);
+  count = 0;
+  work = 0;
+  last = n-m;
+  s = 0;
+  while (s <= last) {
+    s += PAIR(y+s, last-s+1, o1, c1, o2, c2);
+    if (s > last) break;
+    work += m;
+    if (work > GUARD*(long long)s + GUARD_SLACK)
+      return count + twoWay(p, y, n, s, report, ctx, base);
+    if (VERIFY(x, y+s, m)) {
+      ++count;
+      if (report != NULL) {
+        next = report(ctx, base+s);
+        if (next < 0) return count;
+        next = MIN(next-base, n);
+        if (next > s+post) {
+          s = (int)next;
+          continue;
+        }
+      }
+      s += post;
+    }
+    else {
+      ++s;
+    }
+  }
+  return count;
+}
+
+static int krare(ohash_pattern *p, unsigned char *y, int n) {
+  return rareScan(p, y, n, NULL, NULL, 0);
+}
+
+#define SCANS(name, kernel, q, width) \
+  static int name(ohash_pattern *p, unsigned char *y, int n) { \
+    return scan(p, y, n, kernel, q, width, 0, 0, NULL, NULL, 0); \
+  } \
+  static int name##_ro(ohash_pattern *p, unsigned char *y, int n, \
+                       ohash_report report, void *ctx, long long base) { \
+    return scan(p, y, n, kernel, q, width, 0, 1, report, ctx, base); \
+  } \
+  static int name##_la(ohash_pattern *p, unsigned char *y, int n) { \
+    return scan(p, y, n, kernel, q, width, 1, 0, NULL, NULL, 0); \
+  } \
+  static int name##_la_ro(ohash_pattern *p, unsigned char *y, int n, \
+                          ohash_report report, void *ctx, long long base) { \
+    return scan(p, y, n, kernel, q, width, 1, 1, report, ctx, base); \
+  }
+
+// name for the tables of bytes, name_w for those of 16 bits
+#define KERNEL(name, kernel, q) \
+  SCANS(name, kernel, q, 1) \
+  SCANS(name##_w, kernel, q, 2)
+
+KERNEL(kbyte, OHASH_K_BYTE, 1)
+KERNEL(kshl1_2, OHASH_K_SHL1, 2)
+KERNEL(kshl1_3, OHASH_K_SHL1, 3)
+KERNEL(kshl1_4, OHASH_K_SHL1, 4)
+KERNEL(kshl1_5, OHASH_K_SHL1, 5)
+KERNEL(kshl1_6, OHASH_K_SHL1, 6)
+KERNEL(kshl1_7, OHASH_K_SHL1, 7)
+KERNEL(kshl1_8, OHASH_K_SHL1, 8)
+KERNEL(kshl1_9, OHASH_K_SHL1, 9)
+KERNEL(kshl1_10, OHASH_K_SHL1, 10)
+KERNEL(kshl8, OHASH_K_SHL8, 2)
+KERNEL(krank3, OHASH_K_RANK, 3)
+KERNEL(krank4, OHASH_K_RANK, 4)
+KERNEL(krank5, OHASH_K_RANK, 5)
+KERNEL(krank, OHASH_K_RANK, 0)
+KERNEL(ktwo3, OHASH_K_TWO3, 3)
+KERNEL(khash3, OHASH_K_HASH3, 3)
+KERNEL(khash8, OHASH_K_HASH8, 8)
+KERNEL(kwide, OHASH_K_WIDE, 0)
+
+#define PICK(p, name) \
+  ((p)->run = (p)->look ? name##_la : name, (p)->find = (p)->look ? name##_la_ro : name##_ro)
+#define BIND(p, name) \
+  ((p)->width == 1 ? PICK(p, name) : PICK(p, name##_w))
+
+// Sets the kernels of p for its hash family and q
+static void bind(ohash_pattern *p) {
+  factorize(p);
+  if (p->vlen >= 8) {
+    memcpy(&p->head, p->x, 8);
+    memcpy(&p->tail, p->x+p->vlen-8, 8);
+  }
+  if (p->rare) {
+    p->run = krare;
+    p->find = rareScan;
+    return;
+  }
+  switch (p->kernel) {
+    case OHASH_K_BYTE :
+      BIND(p, kbyte);
+      break;
+    case OHASH_K_SHL1 :
+      switch (p->q) {
+        case 2 : BIND(p, kshl1_2); break;
+        case 3 : BIND(p, kshl1_3); break;
+        case 4 : BIND(p, kshl1_4); break;
+        case 5 : BIND(p, kshl1_5); break;
+        case 6 : BIND(p, kshl1_6); break;
+        case 7 : BIND(p, kshl1_7); break;
+        case 8 : BIND(p, kshl1_8); break;
+        case 9 : BIND(p, kshl1_9); break;
+        default : BIND(p, kshl1_10);
+      }
+      break;
+    case OHASH_K_SHL8 :
+      BIND(p, kshl8);
+      break;
+    case OHASH_K_RANK :
+      switch (p->q) {
+        case 3 : BIND(p, krank3); break;
+        case 4 : BIND(p, krank4); break;
+        case 5 : BIND(p, krank5); break;
+        default : BIND(p, krank);
+      }
+      break;
+    case OHASH_K_TWO3 :
+      BIND(p, ktwo3);
+      break;
+    case OHASH_K_HASH3 :
+      BIND(p, khash3);
+      break;
+    case OHASH_K_HASH8 :
+      BIND(p, khash8);
+      break;
+    default :
+      BIND(p, kwide);
+  }
+}
+
+// Checks the fields of a pattern built elsewhere (ohash_store.c) against
+// what buildShift() makes, so that no kernel reads out of its tables
+int ohash_bind(ohash_pattern *p) {
+  int i, rows, size, perfect;
+
+  // the kernels move by sh0, sh1 and the entries of shift: none may go
+  // past m-q+1, which keeps the window index within the chunk
+  if (p->m < 1 || p->q < 1 || p->q > p->m || p->sh0 != p->m-p->q+1
+      || p->sh1 < 1 || p->sh1 > p->sh0 || p->x == NULL)
+    return -1;
+  perfect = 0;
+  switch (p->kernel) {
+    case OHASH_K_BYTE :
+      size = p->q == 1 ? ASIZE : -1;
+      perfect = 1;
+      break;
+    case OHASH_K_SHL1 :
+      size = p->q >= 2 && p->q <= 10 ? DSIGMA : -1;
+      break;
+    case OHASH_K_SHL8 :
+      size = p->q == 2 ? DSIGMA : -1;
+      perfect = 1;
+      break;
+    case OHASH_K_RANK :
+      size = p->q >= 3 && p->b >= 1 && p->b*p->q <= 16 ? 1<<(p->b*p->q) : -1;
+      for (i = 0; i < ASIZE; ++i)
+        if (p->rank[i] >= 1<<p->b) size = -1;
+      perfect = 1;
+      break;
+    case OHASH_K_TWO3 :
+      if (p->q != 3) return -1;
+      perfect = 1;
+      size = 0;
+      if (p->rare) break;
+      if (p->bits == NULL || p->slot == NULL
+          || p->tsize < 0 || p->tsize%ASIZE != 0 || p->tsize > (p->m-2)*ASIZE)
+        return -1;
+      rows = p->tsize/ASIZE;
+      for (i = 0; i < DSIGMA; ++i)
+        if ((p->bits[i>>5] & (1U<<(i&31))) && p->slot[i] >= rows) return -1;
+      size = rows*ASIZE;
+      break;
+    case OHASH_K_HASH3 :
+      size = p->q == 3 ? ASIZE : -1;
+      break;
+    case OHASH_K_HASH8 :
+      size = p->q == 8 ? ASIZE : -1;
+      break;
+    case OHASH_K_WIDE :
+      size = p->q > 10 && p->q <= OHASH_QMAX ? DSIGMA : -1;
+      break;
+    default :
+      return -1;
+  }
+  // symbols certified by a perfect hash are not verified
+  if (size < 0 || p->vlen != (perfect ? p->m-p->q : p->m)) return -1;
+  // the rare-byte engine has no table
+  if (p->rare) {
+    if (p->tsize != 0 || p->o1 < 0 || p->o1 >= p->m || p->o2 < 0 || p->o2 >= p->m)
+      return -1;
+  }
+  else {
+    if (p->tsize != size || p->shift == NULL || p->width != WIDTH(p->sh0)) return -1;
+    for (i = 0; i < p->tsize; ++i)
+      if (entry(p, i, p->width) > p->sh0) return -1;
+  }
+  if (p->probes < 0 || p->probes > OHASH_PROBES) return -1;
+  for (i = 0; i < p->probes; ++i)
+    if (p->probe[i] < 0 || p->probe[i] >= p->vlen) return -1;
+  bind(p);
+  return 0;
+}
+
+
+// 1 if the q-grams of x fall in pairwise distinct slots of kernel. seen
+// is clear on entry and left clear, which costs O(m) instead of clearing
+// 8 KB for each q tried
+static int collisionFree(ohash_pattern *p, int kernel, int q, unsigned int *seen) {
+  unsigned int h;
+  int i, k;
+
+  for (i = q-1; i < p->m; ++i) {
+    h = slot(p, p->x+i, kernel, q);
+    if (seen[h>>5] & (1U<<(h&31))) break;
+    seen[h>>5] |= 1U<<(h&31);
+  }
+  for (k = q-1; k < i; ++k) {
+    h = slot(p, p->x+k, kernel, q);
+    seen[h>>5] &= ~(1U<<(h&31));
+  }
+  return i == p->m;
+}
+
+// Smallest q' in [q, qmax] with no collision, shift-1 hashing up to
+// q' = 10 and 64-bit keys above. 0 if there is none
+static int firstFree(ohash_pattern *p, int q, int qmax) {
+  unsigned int seen[DSIGMA/32];
+
+  memset(seen, 0, sizeof(seen));
+  for (; q <= qmax; ++q)
+    if (collisionFree(p, q <= 10 ? OHASH_K_SHL1 : OHASH_K_WIDE, q, seen))
+      return q;
+  return 0;
+}
+
+static void use(ohash_pattern *p, int kernel, int q) {
+  p->kernel = kernel;
+  p->q = q;
+}
+
+// Long repeats: 64-bit keys while the shifts stay long, HASH8 otherwise
+static void planWide(ohash_pattern *p, int q) {
+  int r;
+
+  r = firstFree(p, MAX(q, 11), MIN(OHASH_QMAX, p->m/2));
+  if (r) use(p, OHASH_K_WIDE, r);
+  else use(p, OHASH_K_HASH8, 8);
+}
+
+// ohash1.c
+static void plan1(ohash_pattern *p, int q) {
+  int r;
+
+  if (q == 1) {
+    use(p, OHASH_K_BYTE, 1);
+    return;
+  }
+  r = firstFree(p, q, MAX(10, MIN(OHASH_QMAX, p->m/2)));
+  if (r == 0) use(p, OHASH_K_HASH8, 8);
+  else if (r <= 10) use(p, OHASH_K_SHL1, r);
+  else use(p, OHASH_K_WIDE, r);
+}
+
+// ohash2.c
+static void plan2(ohash_pattern *p, int q) {
+  if (q == 1) use(p, OHASH_K_BYTE, 1);
+  else if (q == 2) use(p, OHASH_K_SHL8, 2);
+  else if (p->b*q <= 16) use(p, OHASH_K_RANK, q);
+  else if (q <= 10) use(p, OHASH_K_SHL1, q);
+  else planWide(p, q);
+}
+
+// ohash3.c
+static void plan3(ohash_pattern *p, int q) {
+  if (q == 1) use(p, OHASH_K_BYTE, 1);
+  else if (q == 2) use(p, OHASH_K_SHL8, 2);
+  else if (q == 3) use(p, OHASH_K_TWO3, 3);
+  else if (q <= 10) use(p, OHASH_K_HASH3, 3);
+  else planWide(p, q);
+}
+
+// Bytes by decreasing frequency in English text and logs
+static const char common[] = " etaoinsrhldcumfpgwybv,.k\n0-1:2/T5\"SA3IC4'9_8E67=x)(NR";
+
+// Estimated frequencies of the bytes in English text and logs, in
+// 1/65536: Zipf's law over common[], the other bytes being the rarest
+static void textProfile(size_t *freq) {
+  int i;
+
+  for (i = 0; i < ASIZE; ++i)
+    freq[i] = 16;
+  for (i = 0; common[i] != '\0'; ++i)
+    freq[(unsigned char)common[i]] = 13107/(i+1);
+}
+
+// Offsets of the two rarest bytes of x for the rare-byte engine, of two
+// different values when x has them, the first ones on ties
+static void pickPair(ohash_pattern *p, const size_t *freq) {
+  unsigned char *x;
+  int i, o1, o2;
+
+  x = p->x;
+  o1 = 0;
+  for (i = 1; i < p->m; ++i)
+    if (freq[x[i]] < freq[x[o1]]) o1 = i;
+  o2 = -1;
+  for (i = 0; i < p->m; ++i)
+    if (x[i] != x[o1] && (o2 < 0 || freq[x[i]] < freq[x[o2]])) o2 = i;
+  if (o2 < 0) o2 = o1 == p->m-1 ? 0 : p->m-1;
+  p->o1 = o1;
+  p->o2 = o2;
+}
+
+// Cost model of the dispatcher: the skip loop reads one q-gram every
+// m-q+1 bytes at best, the pair scan tests the lanes of the selected
+// SIMD variant at once but stops at every window holding the pair, at
+// the cost of RARE_STOP q-gram reads
+static int rareWins(ohash_pattern *p, int q, const size_t *freq) {
+  double hit, rare, skip;
+
+  hit = (double)freq[p->x[p->o1]]/65536.0;
+  if (p->x[p->o2] != p->x[p->o1]) hit *= (double)freq[p->x[p->o2]]/65536.0;
+  rare = 1.0/isa->lanes + hit*RARE_STOP;
+  skip = 1.0/MAX(p->m-q+1, 1);
+  return rare < skip;
+}
+
+// Per-pattern choice: a perfect hash when one exists at q = maxRepeat+1,
+// then the collision-free q of ohash1.c, then the small HASH3 table
+static int choose(ohash_pattern *p, int q) {
+  if (q <= 2 || p->b*q <= 16) return OHASH_2;
+  if (q == 3) return OHASH_3;
+  if (q > 10 || firstFree(p, q, 10)) return OHASH_1;
+  return OHASH_3;
+}
+
+
+// Strategy, kernel, q and rare-byte pair of p, whose repeats are shorter
+// than q. Shared by compile() and ohash_select() so that they agree
+static void plan(ohash_pattern *p, int q, int strategy) {
+  size_t freq[ASIZE];
+  int pick, rare;
+
+  pick = strategy == OHASH_AUTO;
+  rare = strategy == OHASH_RARE;
+  if (pick || rare)
+    strategy = choose(p, q);
+  p->strategy = strategy;
+  switch (strategy) {
+    case OHASH_1 :
+      plan1(p, q);
+      break;
+    case OHASH_2 :
+      plan2(p, q);
+      break;
+    default :
+      p->strategy = OHASH_3;
+      plan3(p, q);
+  }
+  textProfile(freq);
+  pickPair(p, freq);
+  p->rare = rare || (pick && rareWins(p, p->q, freq));
+}
+
+// Allocates and fills the tables of the kernel chosen for p
+static int buildShift(struct arena *a, ohash_pattern *p) {
+  unsigned char *x;
+  unsigned int h;
+  int i, m, rows;
+
+  x = p->x;
+  m = p->m;
+  p->sh0 = m-p->q+1;
+  p->sh1 = 1;
+  // symbols certified by a perfect hash need no verification
+  switch (p->kernel) {
+    case OHASH_K_BYTE :
+    case OHASH_K_SHL8 :
+    case OHASH_K_RANK :
+    case OHASH_K_TWO3 :
+      p->vlen = m-p->q;
+      break;
+    default :
+      p->vlen = m;
+  }
+  // the rare-byte engine reads no table
+  if (p->rare) {
+    p->tsize = 0;
+    bind(p);
+    return 0;
+  }
+
+  switch (p->kernel) {
+    case OHASH_K_BYTE :
+    case OHASH_K_HASH3 :
+    case OHASH_K_HASH8 :
+      p->tsize = ASIZE;
+      break;
+    case OHASH_K_RANK :
+      p->tsize = 1<<(p->b*p->q);
+      break;
+    case OHASH_K_TWO3 :
+      // first level: bitmap of the bigrams ending a trigram of x, each
+      // one owning a row of the second level indexed by the first symbol
+      p->bits = (unsigned int *)take(a, DSIGMA/8);
+      p->slot = (unsigned short *)take(a, DSIGMA*sizeof(unsigned short));
+      if (p->bits == NULL || p->slot == NULL) return -1;
+      memset(p->bits, 0, DSIGMA/8);
+      rows = 0;
+      for (i = 2; i < m; ++i) {
+        h = (x[i-1]<<8) | x[i];
+        if (!(p->bits[h>>5] & (1U<<(h&31)))) {
+          p->bits[h>>5] |= 1U<<(h&31);
+          p->slot[h] = rows++;
+        }
+      }
+      p->tsize = rows*ASIZE;
+      break;
+    default :
+      p->tsize = DSIGMA;
+  }
+  p->width = WIDTH(p->sh0);
+  p->shift = take(a, (size_t)p->tsize*p->width);
+  if (p->shift == NULL) return -1;
+
+  if (p->width == 1) memset(p->shift, p->sh0, p->tsize);
+  else
+    for (i = 0; i < p->tsize; ++i)
+      ((unsigned short *)p->shift)[i] = MIN(p->sh0, SHIFT16);
+  for (i = p->q-1; i < m-1; ++i)
+    setEntry(p, slot(p, x+i, p->kernel, 0), m-1-i);
+  // the shift after a verified window is kept exact when the entries are
+  // cut: it comes from the last other q-gram of x in the slot of its last
+  h = slot(p, x+m-1, p->kernel, 0);
+  for (i = m-2; i >= p->q-1 && slot(p, x+i, p->kernel, 0) != h; --i);
+  p->sh1 = i >= p->q-1 ? m-1-i : p->sh0;
+  setEntry(p, h, 0);
+  bind(p);
+  return 0;
+}
+
+static ohash_pattern *compile(struct arena *a, unsigned char *x, int m, int strategy) {
+  ohash_pattern *p;
+  int q, look;
+
+  if (m < 1) return NULL;
+  p = (ohash_pattern *)take(a, sizeof(ohash_pattern));
+  if (p == NULL) return NULL;
+  memset(p, 0, sizeof(ohash_pattern));
+  p->inplace = a->base != NULL;
+  p->x = (unsigned char *)take(a, m+1);
+  if (p->x == NULL) goto fail;
+  memcpy(p->x, x, m);
+  p->x[m] = '\0';
+  p->m = m;
+
+  q = maxRepeat(a, x, m);
+  if (q < 0) goto fail;
+  ++q;
+  p->b = buildRanks(x, m, p->rank);
+  look = (strategy & OHASH_LOOK) != 0;
+  strategy &= ~OHASH_LOOK;
+  plan(p, q, strategy);
+  p->look = look || (strategy == OHASH_AUTO && m-p->q+1 <= LOOK_SHIFT);
+  if (buildShift(a, p) < 0) goto fail;
+  return p;
+
+fail:
+  ohash_free(p);
+  return NULL;
+}
+
+ohash_pattern *ohash_compile(unsigned char *x, int m, int strategy) {
+  struct arena a;
+
+  memset(&a, 0, sizeof(a));
+  return compile(&a, x, m, strategy);
+}
+
+// The pieces of a pattern, each rounded up to a cache line: the pattern,
+// x, then the suffix array, which the tables overwrite once q is known.
+// TWO3 has at most m-2 rows
+size_t ohash_workspace_size(int m) {
+  size_t scratch, tables, rows;
+
+  if (m < 1) return 0;
+  scratch = ALIGNED(m*sizeof(struct suffix)) + ALIGNED(m*sizeof(int));
+  rows = MIN(m, DSIGMA);
+  tables = ALIGNED(DSIGMA/8) + ALIGNED(DSIGMA*sizeof(unsigned short))
+           + ALIGNED(MAX(DSIGMA, rows*ASIZE)*WIDTH(m));
+  return LINE + ALIGNED(sizeof(ohash_pattern)) + ALIGNED(m+1) + MAX(scratch, tables);
+}
+
+ohash_pattern *ohash_compile_in(void *ws, size_t size, unsigned char *x, int m, int strategy) {
+  struct arena a;
+
+  if (inWorkspace(&a, ws, size) < 0) return NULL;
+  return compile(&a, x, m, strategy);
+}
+
+static ohash_pattern *cloneInto(struct arena *a, ohash_pattern *p) {
+  ohash_pattern *c;
+
+  c = (ohash_pattern *)take(a, sizeof(ohash_pattern));
+  if (c == NULL) return NULL;
+  *c = *p;
+  c->inplace = a->base != NULL;
+  c->owner = NULL;
+  c->bits = NULL;
+  c->slot = NULL;
+  c->shift = NULL;
+  c->x = (unsigned char *)take(a, p->m+1);
+  if (c->x == NULL) goto fail;
+  memcpy(c->x, p->x, p->m);
+  c->x[p->m] = '\0';
+  if (p->shift != NULL) {
+    c->shift = take(a, (size_t)p->tsize*p->width);
+    if (c->shift == NULL) goto fail;
+    memcpy(c->shift, p->shift, (size_t)p->tsize*p->width);
+  }
+  if (p->bits != NULL) {
+    c->bits = (unsigned int *)take(a, DSIGMA/8);
+    if (c->bits == NULL) goto fail;
+    c->slot = (unsigned short *)take(a, DSIGMA*sizeof(unsigned short));
+    if (c->slot == NULL) goto fail;
+    memcpy(c->bits, p->bits, DSIGMA/8);
+    memcpy(c->slot, p->slot, DSIGMA*sizeof(unsigned short));
+  }
+  return c;
+
+fail:
+  ohash_free(c);
+  return NULL;
+}
+
+// Deep copy, with the kernel of p. The tables are first written by the
+// calling thread
+ohash_pattern *ohash_clone(ohash_pattern *p) {
+  struct arena a;
+
+  memset(&a, 0, sizeof(a));
+  return cloneInto(&a, p);
+}
+
+int ohash_order(ohash_pattern *p, const unsigned char *sample, size_t n) {
+  size_t freq[ASIZE], f;
+  int c, i, j, k;
+
+  if (sample != NULL) {
+    memset(freq, 0, sizeof(freq));
+    for (f = 0; f < n; ++f) freq[sample[f]]++;
+  }
+  else
+    textProfile(freq);
+  // one position per byte value, kept sorted by frequency, the first
+  // position on ties
+  p->probes = 0;
+  for (i = 0; i < p->vlen; ++i) {
+    c = p->x[i];
+    for (j = 0; j < p->probes && p->x[p->probe[j]] != c; ++j);
+    if (j < p->probes) continue;
+    if (p->probes == OHASH_PROBES && freq[c] >= freq[p->x[p->probe[OHASH_PROBES-1]]])
+      continue;
+    k = MIN(p->probes, OHASH_PROBES-1);
+    while (k > 0 && freq[p->x[p->probe[k-1]]] > freq[c]) {
+      p->probe[k] = p->probe[k-1];
+      --k;
+    }
+    p->probe[k] = i;
+    if (p->probes < OHASH_PROBES) p->probes++;
+  }
+  if (p->rare) pickPair(p, freq);
+  return p->probes;
+}
+
+// As laid out by compile() and cloneInto()
+size_t ohash_pattern_size(ohash_pattern *p) {
+  size_t size;
+
+  size = LINE + ALIGNED(sizeof(ohash_pattern)) + ALIGNED(p->m+1);
+  if (p->shift != NULL)
+    size += ALIGNED((size_t)p->tsize*p->width);
+  if (p->bits != NULL)
+    size += ALIGNED(DSIGMA/8) + ALIGNED(DSIGMA*sizeof(unsigned short));
+  return size;
+}
+
+// Texts longer than OHASH_CHUNK are searched by chunks overlapping by
+// m-1 bytes, so that the kernels keep int indices. Only the last chunk
+// has room for a sentinel, the others are searched with the guarded loop
+long long ohash_exec(ohash_pattern *p, unsigned char *y, size_t n) {
+  long long count;
+  size_t from;
+  int len;
+
+  if (n <= OHASH_CHUNK) return p->run(p, y, (int)n);
+  count = 0;
+  for (from = 0; ; from += len-(p->m-1)) {
+    len = (int)MIN(OHASH_CHUNK, n-from);
+    if (from+len == n) {
+      count += p->run(p, y+from, len);
+      break;
+    }
+    count += p->find(p, y+from, len, NULL, NULL, from);
+  }
+  return count;
+}
+
+// Passes the occurrences of a chunk on, keeping where to go on from
+struct relay {
+  ohash_report report;
+  void *ctx;
+  long long next;
+};
+
+static long long relay(void *ctx, long long pos) {
+  struct relay *r = (struct relay *)ctx;
+
+  r->next = r->report(r->ctx, pos);
+  return r->next;
+}
+
+long long ohash_scan(ohash_pattern *p, unsigned char *y, size_t n, ohash_report report, void *ctx) {
+  struct relay r;
+  long long count;
+  size_t from, end;
+
+  if (n <= OHASH_CHUNK) return p->find(p, y, (int)n, report, ctx, 0);
+  r.report = report;
+  r.ctx = ctx;
+  r.next = 0;
+  count = 0;
+  from = 0;
+  while (1) {
+    end = MIN(from+OHASH_CHUNK, n);
+    if (report == NULL)
+      count += p->find(p, y+from, (int)(end-from), NULL, NULL, from);
+    else
+      count += p->find(p, y+from, (int)(end-from), relay, &r, from);
+    if (end == n || r.next < 0) break;
+    // the next chunk starts m-1 bytes back, or where report asked
+    from = MAX(end-(p->m-1), (size_t)r.next);
+    if (from+p->m > n) break;
+  }
+  return count;
+}
+
+// Occurrences kept by ohash_some() and ohash_last()
+struct keep {
+  long long *pos;
+  long long max;
+  long long count;
+  long long last;
+  size_t base;
+};
+
+static long long keep(void *ctx, long long pos) {
+  struct keep *k = (struct keep *)ctx;
+
+  if (k->pos != NULL) k->pos[k->count] = k->base+pos;
+  k->last = k->base+pos;
+  if (++k->count >= k->max) return -1;
+  return pos+1;
+}
+
+long long ohash_some(ohash_pattern *p, unsigned char *y, size_t from, size_t to,
+                     long long *pos, long long max) {
+  struct keep k;
+
+  if (max < 1 || to < from || to-from < (size_t)p->m) return 0;
+  k.pos = pos;
+  k.max = max;
+  k.count = 0;
+  k.base = from;
+  ohash_scan(p, y+from, to-from, keep, &k);
+  return k.count;
+}
+
+long long ohash_first(ohash_pattern *p, unsigned char *y, size_t from, size_t to) {
+  long long pos;
+
+  return ohash_some(p, y, from, to, &pos, 1) > 0 ? pos : -1;
+}
+
+// Blocks of doubling size are searched from the end of the range, each
+// one overlapping the next by m-1 bytes, so the search stops in the
+// first block holding an occurrence and reads at most twice the bytes
+// after the last one
+long long ohash_last(ohash_pattern *p, unsigned char *y, size_t from, size_t to) {
+  struct keep k;
+  size_t lo, hi, block;
+
+  if (to < from) return -1;
+  block = MAX(LAST_BLOCK, 2*(size_t)p->m);
+  k.pos = NULL;
+  k.max = LLONG_MAX;
+  hi = to;
+  while (hi-from >= (size_t)p->m) {
+    lo = hi-from > block ? hi-block : from;
+    k.count = 0;
+    k.base = lo;
+    ohash_scan(p, y+lo, hi-lo, keep, &k);
+    if (k.count > 0) return k.last;
+    if (lo == from) break;
+    hi = lo+p->m-1;
+    block *= 2;
+  }
+  return -1;
+}
+
+void ohash_free(ohash_pattern *p) {
+  if (p == NULL || p->inplace) return;
+  free(p->x);
+  free(p->shift);
+  free(p->bits);
+  free(p->slot);
+  free(p);
+}
+
+int ohash_select(unsigned char *x, int m) {
+  ohash_pattern p;
+  struct arena a;
+  int q;
+
+  if (m < 1) return -1;
+  memset(&p, 0, sizeof(p));
+  p.x = x;
+  p.m = m;
+  memset(&a, 0, sizeof(a));
+  q = maxRepeat(&a, x, m);
+  if (q < 0) return -1;
+  p.b = buildRanks(x, m, p.rank);
+  plan(&p, q+1, OHASH_AUTO);
+  return p.rare ? OHASH_RARE : p.strategy;
+}
+
+const char *ohash_kernel_name(ohash_pattern *p, char *buf, int size) {
+  static const char *names[OHASH_K_COUNT] = {
+    "byte", "shl1", "shl8", "rank", "two3", "hash3", "hash8", "wide"
+  };
+
+  snprintf(buf, size, "%s%s/%d%s", p->rare ? "rare:" : "", names[p->kernel], p->q,
+           p->look && !p->rare ? "+look" : "");
+  return buf;
+}
+
+const char *ohash_isa(void) {
+  return isa_name();
+}
+
+
+static int searchWith(unsigned char *x, int m, unsigned char *y, int n, int strategy) {
+  ohash_pattern *p;
+  int count;
+
+  p = ohash_compile(x, m, strategy);
+  if (p == NULL) return -1;
+  count = (int)ohash_exec(p, y, n);
+  ohash_free(p);
+  return count;
+}
+
+int ohash1_search(unsigned char *x, int m, unsigned char *y, int n) {
+  return searchWith(x, m, y, n, OHASH_1);
+}
+
+int ohash2_search(unsigned char *x, int m, unsigned char *y, int n) {
+  return searchWith(x, m, y, n, OHASH_2);
+}
+
+int ohash3_search(unsigned char *x, int m, unsigned char *y, int n) {
+  return searchWith(x, m, y, n, OHASH_3);
+}
+
+int ohash_search(unsigned char *x, int m, unsigned char *y, int n) {
+  return searchWith(x, m, y, n, OHASH_AUTO);
+}
@@ -0,0 +1,170 @@
+/*
+ * ohash: the Optimal Hash string matching algorithms as a library.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ohash1.c, ohash2.c and ohash3.c are SMART plugins: each one defines its
+ * own search(), so only one of them can be linked in a program. This
+ * library holds the three strategies under distinct names and picks the
+ * best one for each pattern.
+ *
+ * As in SMART, ohash_exec() and the one-shot searches need the text y to
+ * be followed by at least m writable bytes: the pattern is copied there
+ * as a sentinel to stop the skip loop. ohash_scan() checks the end of the
+ * text instead and never writes y, so it runs on read-only mappings.
+ * Both take size_t lengths and return 64-bit counts; the one-shot
+ * searches keep the int contract of SMART.
+ *
+ * The searches allocate nothing and only read the pattern, so one pattern
+ * may be used by many threads at once. The only global state is the SIMD
+ * variant chosen when the library is loaded.
+ */
+
+#ifndef OHASH_H
+#define OHASH_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Strategies
+#define OHASH_AUTO 0
+#define OHASH_1 1   // ohash1.c: q-grams hashed with possible collisions
+#define OHASH_2 2   // ohash2.c: perfect hashing for q = 2 and reduced alphabets
+#define OHASH_3 3   // ohash3.c: perfect hashing for q = 3, HASH3 above
+#define OHASH_RARE 4  // SIMD scan for the two rarest bytes of x, then verification
+#define OHASH_LOOK 8  // or-ed to 1, 2 or 3: lookahead q-gram in the skip loop
+
+// Kernels
+#define OHASH_K_BYTE 0    // q = 1, one byte
+#define OHASH_K_SHL1 1    // 2 <= q <= 10, (h<<1) + c modulo 65536
+#define OHASH_K_SHL8 2    // q = 2, (h<<8) + c, perfect
+#define OHASH_K_RANK 3    // reduced alphabet, (h<<b) | rank[c], perfect
+#define OHASH_K_TWO3 4    // q = 3, bigram bitmap then row of 256, perfect
+#define OHASH_K_HASH3 5   // q = 3, 8-bit hash
+#define OHASH_K_HASH8 6   // q = 8, hash modulo 256
+#define OHASH_K_WIDE 7    // 10 < q <= 64, 64-bit keys folded to 16 bits
+#define OHASH_K_COUNT 8
+
+#define OHASH_QMAX 64
+
+// Positions of x compared first by the verification (see ohash_order())
+#define OHASH_PROBES 4
+
+// Longest text passed to a kernel; longer ones are split by ohash_exec()
+// and ohash_scan()
+#define OHASH_CHUNK (1<<30)
+
+typedef struct ohash_pattern ohash_pattern;
+
+// Called with the position of each occurrence; returns the position from
+// which the search goes on (pos+1 to get every occurrence, the start of
+// the next line to get each line once) or -1 to stop
+typedef long long (*ohash_report)(void *ctx, long long pos);
+
+// Kernels, on at most OHASH_CHUNK bytes; base is added to the positions
+// passed to report
+typedef int (*ohash_kernel)(ohash_pattern *p, unsigned char *y, int n);
+typedef int (*ohash_finder)(ohash_pattern *p, unsigned char *y, int n,
+                            ohash_report report, void *ctx, long long base);
+
+// A preprocessed pattern
+struct ohash_pattern {
+  unsigned char *x;         // copy of the pattern
+  int m;
+  int strategy;             // OHASH_1, OHASH_2 or OHASH_3, for the tables
+  int kernel;               // OHASH_K_*
+  int q;
+  int b;                    // bits per symbol for OHASH_K_RANK
+  int sh0;                  // shift of a q-gram absent from x
+  int sh1;                  // shift after a verified window
+  int vlen;                 // bytes of a window left to verify
+  int tsize;                // entries of shift, 0 for the rare-byte engine
+  int width;                // bytes of an entry of shift: 1 if sh0 < 256, else 2
+  void *shift;              // unsigned char or unsigned short entries
+  unsigned int *bits;       // OHASH_K_TWO3 bigram bitmap
+  unsigned short *slot;     // OHASH_K_TWO3 row of each bigram
+  unsigned char rank[256];  // OHASH_K_RANK symbol classes
+  int ell, per, periodic;   // critical factorization: fallback, shift after a match
+  unsigned long long head;   // x[0..7] as a word, when vlen >= 8
+  unsigned long long tail;   // x[vlen-8..vlen-1] as a word
+  int probes;                // positions in probe
+  int probe[OHASH_PROBES];   // of the rarest bytes of x[0..vlen-1], rarest first
+  int rare;                 // searched by the rare-byte engine
+  int o1, o2;               // offsets of its two rarest bytes of x
+  int look;                 // shift also by the q-gram ending after the window
+  ohash_kernel run;         // sentinel kernel
+  ohash_finder find;        // guarded kernel
+  int inplace;              // compiled in a workspace of the caller
+  void *owner;              // entry of ohash_cache.c holding the pattern
+};
+
+// Preprocesses x[0..m-1] with the given strategy (OHASH_AUTO lets
+// ohash_select() choose). The tables of OHASH_RARE are those of the
+// choice among the three others. Returns NULL if m < 1 or out of memory
+ohash_pattern *ohash_compile(unsigned char *x, int m, int strategy);
+// Same in the workspace ws of size bytes, at least
+// ohash_workspace_size(m): nothing is allocated, and the pattern lives
+// until ws is reused or freed (ohash_free() does nothing on it). Returns
+// NULL if m < 1 or ws is too small
+ohash_pattern *ohash_compile_in(void *ws, size_t size, unsigned char *x, int m, int strategy);
+size_t ohash_workspace_size(int m);
+// Number of occurrences of p in y[0..n-1]
+long long ohash_exec(ohash_pattern *p, unsigned char *y, size_t n);
+// Same without writing y, each occurrence is passed to report if not
+// NULL. Returns the number of occurrences reported
+long long ohash_scan(ohash_pattern *p, unsigned char *y, size_t n, ohash_report report, void *ctx);
+// Searches of y[from..to-1] that stop early, without writing y; the
+// positions are offsets in y. ohash_some() stores the first max
+// occurrences in pos if not NULL and returns how many there are
+long long ohash_some(ohash_pattern *p, unsigned char *y, size_t from, size_t to,
+                     long long *pos, long long max);
+// First and last occurrence, -1 if there is none
+long long ohash_first(ohash_pattern *p, unsigned char *y, size_t from, size_t to);
+long long ohash_last(ohash_pattern *p, unsigned char *y, size_t from, size_t to);
+void ohash_free(ohash_pattern *p);
+// Validates the tables of a pattern filled in by the caller and sets its
+// kernels. Returns -1 if they do not match the kernel
+int ohash_bind(ohash_pattern *p);
+// Copy of p with its own tables, e.g. one per NUMA node
+ohash_pattern *ohash_clone(ohash_pattern *p);
+// Bytes of p and its tables; a pattern compiled in a workspace uses no
+// more than that of it
+size_t ohash_pattern_size(ohash_pattern *p);
+
+// Makes the verification of p compare first the positions of its rarest
+// bytes, by their frequency in sample[0..n-1], or in English text and
+// logs if sample is NULL; the rare-byte engine takes its two bytes from
+// the same frequencies. Returns the number of positions chosen
+int ohash_order(ohash_pattern *p, const unsigned char *sample, size_t n);
+
+// Strategy the dispatcher uses for x, -1 where ohash_compile() fails
+int ohash_select(unsigned char *x, int m);
+// Name of the kernel of p, e.g. "shl1/5"
+const char *ohash_kernel_name(ohash_pattern *p, char *buf, int size);
+// SIMD variant selected at startup (see ohash_isa.h)
+const char *ohash_isa(void);
+
+// One-shot searches, same contract as the SMART search()
+int ohash1_search(unsigned char *x, int m, unsigned char *y, int n);
+int ohash2_search(unsigned char *x, int m, unsigned char *y, int n);
+int ohash3_search(unsigned char *x, int m, unsigned char *y, int n);
+int ohash_search(unsigned char *x, int m, unsigned char *y, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
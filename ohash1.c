@@ -21,20 +21,44 @@
 
 #include "include/define.h"
 #include "include/main.h"
+#include "ohash_isa.h"
 
 
 
 #define ASIZE 256
 #define DSIGMA 65536
+#define QMAX 64
+#define GOLDEN64 0x9E3779B97F4A7C15ULL
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 
-int HS(unsigned char *x, int i, int q) {
+// Key of the q-gram starting at s for q > 10: the q bytes are read as
+// (overlapping) 64-bit words, mixed and folded to a DSIGMA index
+unsigned int HQ(unsigned char *s, int q) {
+  unsigned long long h, w;
+  int k;
+
+  h = 0;
+  for (k = 0; k < q-8; k += 8) {
+    memcpy(&w, s+k, 8);
+    h = (h ^ w) * GOLDEN64;
+  }
+  memcpy(&w, s+q-8, 8);
+  h = (h ^ w) * GOLDEN64;
+  return (unsigned int)(h>>48);
+}
+
+// Hash of the q-gram starting at x[i], exactly as computed by the
+// kernel used for that q, so that collisions are checked on it
+unsigned int HS(unsigned char *x, int i, int q) {
   int j;
 
+  if (q > 10)
+    return HQ(x+i, q);
   unsigned int res = x[i];
   for (j = 1; j < q; ++j)
-    res += (x[i+j] << j);
+    res = ((res<<1) + x[i+j]);
   return res%DSIGMA;
 }
 
@@ -105,7 +129,7 @@ int computeMaxLCP(unsigned char *y, int n, int *SA) {
 
 
 int search(unsigned char *x, int m, unsigned char *y, int n) {
-  int i, count, j;
+  int i, count, qmax;
   int z[DSIGMA], hs;
 
   BEGIN_PREPROCESSING
@@ -116,8 +140,10 @@ int search(unsigned char *x, int m, unsigned char *y, int n) {
     y[n+i] = x[i];
   }
   ++q;
+  // beyond q = 10 only keep q-grams short enough to allow long shifts
+  qmax = MAX(10, MIN(QMAX, m/2));
   if (q > 1) {
-    while (q < 11) {
+    while (q <= qmax) {
       memset(z, -1, DSIGMA*sizeof(int));
       for (i = 0; i < m-q+1; ++i) {
         hs = HS(x, i, q);
@@ -150,6 +176,8 @@ int search(unsigned char *x, int m, unsigned char *y, int n) {
     case 10 :
       return ohash10(x, m, y, n);
     default :
+      if (q <= qmax)
+        return ohashq(x, m, y, n, q);
       return hash8(x, m, y, n);
   }
 }
@@ -157,7 +185,7 @@ int search(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK8 8
 
 int hash8(unsigned char *x, int m, unsigned char *y, int n) {
-   int i, j, sh, shift[WSIZE], sh1, mMinus1, mMinus7, count;
+   int i, sh, shift[WSIZE], sh1, mMinus1, mMinus7, count;
    unsigned int h;
    if(m<8) return -1;
 
@@ -165,8 +193,7 @@ int hash8(unsigned char *x, int m, unsigned char *y, int n) {
    count = 0;
    mMinus1 = m-1;
    mMinus7 = m-7;
-   for (i = 0; i < WSIZE; ++i)
-      shift[i] = mMinus7;
+   FILL(shift, mMinus7, WSIZE);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -220,9 +247,7 @@ int hash8(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             OUTPUT(i-mMinus1);
          }
          i+=sh1;
@@ -236,14 +261,13 @@ int hash8(unsigned char *x, int m, unsigned char *y, int n) {
 
 
 int ohash1(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus2, shift[ASIZE];
+   int count, i, sh, sh1, mMinus1, mMinus2, shift[ASIZE];
    unsigned char h;
    if(m<2) return -1;
    count = 0;
    mMinus1 = m-1;
 
-   for (i = 0; i < ASIZE; ++i)
-      shift[i] = m;
+   FILL(shift, m, ASIZE);
 
    h = x[0];
    shift[h] = mMinus1;
@@ -265,9 +289,7 @@ int ohash1(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<mMinus1 && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=mMinus1) {
+         if (VERIFY(x, y+i-mMinus1, mMinus1)) {
             ++count;
          }
          i+=sh1;
@@ -282,7 +304,7 @@ int ohash1(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK2 2
 
 int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus2, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus2, shift[DSIGMA];
    unsigned int h;
    if(m<2) return -1; 
    count = 0;
@@ -291,8 +313,7 @@ int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus2;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -320,9 +341,7 @@ int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -338,7 +357,7 @@ int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK3 3
 
 int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus3, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus3, shift[DSIGMA];
    unsigned int h;
    if(m<3) return -1; 
    count = 0;
@@ -347,8 +366,7 @@ int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus3;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -380,9 +398,7 @@ int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -398,7 +414,7 @@ int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK4 4
 
 int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus4, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus4, shift[DSIGMA];
    unsigned int h;
    if(m<4) return -1; 
    count = 0;
@@ -407,8 +423,7 @@ int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus4;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -444,9 +459,7 @@ int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -462,7 +475,7 @@ int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK5 5
 
 int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus5, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus5, shift[DSIGMA];
    unsigned int h;
    if(m<5) return -1; 
    count = 0;
@@ -471,8 +484,7 @@ int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus5;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -512,9 +524,7 @@ int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -530,7 +540,7 @@ int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK6 6
 
 int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus6, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus6, shift[DSIGMA];
    unsigned int h;
    if(m<6) return -1; 
    count = 0;
@@ -539,8 +549,7 @@ int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus6;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -584,9 +593,7 @@ int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -602,7 +609,7 @@ int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK7 7
 
 int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus7, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus7, shift[DSIGMA];
    unsigned int h;
    if(m<7) return -1; 
    count = 0;
@@ -611,8 +618,7 @@ int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus7;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -660,9 +666,7 @@ int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -678,7 +682,7 @@ int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK8 8
 
 int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus8, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus8, shift[DSIGMA];
    unsigned int h;
    if(m<8) return -1; 
    count = 0;
@@ -687,8 +691,7 @@ int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus8;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -740,9 +743,7 @@ int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             //OUTPUT(i-mMinus1);
             ++count;
          }
@@ -759,7 +760,7 @@ int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK9 9
 
 int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus9, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus9, shift[DSIGMA];
    unsigned int h;
    if(m<9) return -1; 
    count = 0;
@@ -768,8 +769,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus9;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -780,7 +780,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
    h = ((h<<1) + x[6]);
    h = ((h<<1) + x[7]);
    h = ((h<<1) + x[8]);
-   shift[h] = m-RANK9;
+   shift[h%DSIGMA] = m-RANK9;
    for (i=RANK9; i < mMinus1; ++i) {
       h = x[i-8];
       h = ((h<<1) + x[i-7]);
@@ -791,7 +791,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
       h = ((h<<1) + x[i-2]);
       h = ((h<<1) + x[i-1]);
       h = ((h<<1) + x[i]);
-      shift[h] = mMinus1-i;
+      shift[h%DSIGMA] = mMinus1-i;
    }   
    h = x[mMinus9];
    h = ((h<<1) + x[mMinus1-7]);
@@ -802,8 +802,8 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
    h = ((h<<1) + x[mMinus1-2]);
    h = ((h<<1) + x[mMinus1-1]);
    h = ((h<<1) + x[mMinus1]);
-   sh1 = shift[h];
-   shift[h] = 0;
+   sh1 = shift[h%DSIGMA];
+   shift[h%DSIGMA] = 0;
    if(sh1==0) sh1=1;
    END_PREPROCESSING
 
@@ -821,13 +821,11 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
          h = ((h<<1) + y[i-2]);
          h = ((h<<1) + y[i-1]);
          h = ((h<<1) + y[i]);
-         sh = shift[h];
+         sh = shift[h%DSIGMA];
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             //OUTPUT(i-mMinus1);
             ++count;
          }
@@ -844,7 +842,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK10 10
 
 int ohash10(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus10, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus10, shift[DSIGMA];
    unsigned int h;
    if(m<10) return -1; 
    count = 0;
@@ -853,8 +851,7 @@ int ohash10(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus10;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -914,9 +911,52 @@ int ohash10(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
+            ++count;
+         }
+         i+=sh1;
+      }
+      else {
+        END_SEARCHING
+        return count;
+      }
+   }
+}
+
+
+int ohashq(unsigned char *x, int m, unsigned char *y, int n, int q) {
+   int count, i, sh, sh1, mMinus1, mMinusQ, shift[DSIGMA];
+   unsigned int h;
+   if(m<q || q<=10) return -1;
+   count = 0;
+   mMinus1 = m-1;
+   mMinusQ = m-q;
+
+   sh = mMinusQ;
+   if (sh == 0) sh=1;
+   FILL(shift, sh, DSIGMA);
+
+   for (i=q-1; i < mMinus1; ++i) {
+      h = HQ(x+i-q+1, q);
+      shift[h] = mMinus1-i;
+   }
+   h = HQ(x+mMinusQ, q);
+   sh1 = shift[h];
+   shift[h] = 0;
+   if(sh1==0) sh1=1;
+   END_PREPROCESSING
+
+   BEGIN_SEARCHING
+   i = mMinus1;
+   while (1) {
+      sh = 1;
+      while (sh != 0) {
+         h = HQ(y+i-q+1, q);
+         sh = shift[h];
+         i+=sh;
+      }
+      if (i < n) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -21,12 +21,16 @@
 
 #include "include/define.h"
 #include "include/main.h"
+#include "ohash_isa.h"
 
 
 
 #define ASIZE 256
 #define DSIGMA 65536
+#define QMAX 64
+#define GOLDEN64 0x9E3779B97F4A7C15ULL
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 
 int HS(unsigned char *x, int i, int q) {
@@ -38,6 +42,37 @@ int HS(unsigned char *x, int i, int q) {
   return res%DSIGMA;
 }
 
+// Key of the q-gram starting at s for q > 10: the q bytes are read as
+// (overlapping) 64-bit words, mixed and folded to a DSIGMA index
+unsigned int HQ(unsigned char *s, int q) {
+  unsigned long long h, w;
+  int k;
+
+  h = 0;
+  for (k = 0; k < q-8; k += 8) {
+    memcpy(&w, s+k, 8);
+    h = (h ^ w) * GOLDEN64;
+  }
+  memcpy(&w, s+q-8, 8);
+  h = (h ^ w) * GOLDEN64;
+  return (unsigned int)(h>>48);
+}
+
+// Alphabet reduction: ranks the distinct symbols of x densely from 1,
+// every symbol absent from x goes to class 0. Returns the number of
+// bits needed to store one class
+int buildRanks(unsigned char *x, int m, unsigned char *rank) {
+  int i, d, b;
+
+  memset(rank, 0, ASIZE);
+  d = 0;
+  for (i = 0; i < m; ++i)
+    if (rank[x[i]] == 0) rank[x[i]] = ++d;
+  b = 1;
+  while ((1<<b) < d+1) ++b;
+  return b;
+}
+
 // Structure to store information of a suffix
 struct suffix {
   int index;
@@ -105,8 +140,9 @@ int computeMaxLCP(unsigned char *y, int n, int *SA) {
 
 
 int search(unsigned char *x, int m, unsigned char *y, int n) {
-  int i, count, j;
+  int i, count, qmax, b;
   int z[DSIGMA], hs;
+  unsigned char rank[ASIZE];
 
   BEGIN_PREPROCESSING
   int *SA = buildSuffixArray(x, m);
@@ -116,6 +152,11 @@ int search(unsigned char *x, int m, unsigned char *y, int n) {
     y[n+i] = x[i];
   }
   ++q;
+  // few distinct symbols: q-grams over the reduced alphabet fit
+  // a perfect hash table
+  b = buildRanks(x, m, rank);
+  if (q > 2 && b*q <= 16)
+    return ohashr(x, m, y, n, q);
   switch (q) {
     case 1 :
       return ohash1(x, m, y, n);
@@ -138,6 +179,21 @@ int search(unsigned char *x, int m, unsigned char *y, int n) {
     case 10 :
       return ohash10(x, m, y, n);
     default :
+      // long repeats: look for a collision-free q, keeping q-grams
+      // short enough to allow long shifts
+      qmax = MIN(QMAX, m/2);
+      while (q <= qmax) {
+        memset(z, -1, DSIGMA*sizeof(int));
+        for (i = 0; i < m-q+1; ++i) {
+          hs = HQ(x+i, q);
+          if (z[hs] == -1) z[hs] = i;
+          else break;
+        }
+        if (i >= m-q+1) break;
+        else ++q;
+      }
+      if (q <= qmax)
+        return ohashq(x, m, y, n, q);
       return hash8(x, m, y, n);
   }
 }
@@ -145,15 +201,14 @@ int search(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK8 8
 
 int hash8(unsigned char *x, int m, unsigned char *y, int n) {
-   int i, j, sh, shift[WSIZE], sh1, mMinus1, mMinus7, count;
+   int i, sh, shift[WSIZE], sh1, mMinus1, mMinus7, count;
    unsigned int h;
    if(m<8) return -1;
 
    count = 0;
    mMinus1 = m-1;
    mMinus7 = m-7;
-   for (i = 0; i < WSIZE; ++i)
-      shift[i] = mMinus7;
+   FILL(shift, mMinus7, WSIZE);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -207,9 +262,7 @@ int hash8(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             OUTPUT(i-mMinus1);
          }
          i+=sh1;
@@ -223,14 +276,13 @@ int hash8(unsigned char *x, int m, unsigned char *y, int n) {
 
 
 int ohash1(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus2, shift[ASIZE];
+   int count, i, sh, sh1, mMinus1, mMinus2, shift[ASIZE];
    unsigned char h;
    if(m<2) return -1;
    count = 0;
    mMinus1 = m-1;
 
-   for (i = 0; i < ASIZE; ++i)
-      shift[i] = m;
+   FILL(shift, m, ASIZE);
 
    h = x[0];
    shift[h] = mMinus1;
@@ -252,9 +304,7 @@ int ohash1(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<mMinus1 && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=mMinus1) {
+         if (VERIFY(x, y+i-mMinus1, mMinus1)) {
             ++count;
          }
          i+=sh1;
@@ -271,7 +321,7 @@ int ohash1(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK2 2
 
 int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus2, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus2, shift[DSIGMA];
    unsigned int h;
    if(m<2) return -1; 
    count = 0;
@@ -280,8 +330,7 @@ int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus2;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<8) + x[1]);
@@ -309,9 +358,7 @@ int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<mMinus2 && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=mMinus2) {
+         if (VERIFY(x, y+i-mMinus1, mMinus2)) {
             ++count;
          }
          i+=sh1;
@@ -327,7 +374,7 @@ int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK3 3
 
 int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus3, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus3, shift[DSIGMA];
    unsigned int h;
    if(m<3) return -1; 
    count = 0;
@@ -336,8 +383,7 @@ int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus3;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -369,9 +415,7 @@ int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -387,7 +431,7 @@ int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK4 4
 
 int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus4, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus4, shift[DSIGMA];
    unsigned int h;
    if(m<4) return -1; 
    count = 0;
@@ -396,8 +440,7 @@ int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus4;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -433,9 +476,7 @@ int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -451,7 +492,7 @@ int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK5 5
 
 int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus5, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus5, shift[DSIGMA];
    unsigned int h;
    if(m<5) return -1; 
    count = 0;
@@ -460,8 +501,7 @@ int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus5;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -501,9 +541,7 @@ int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -519,7 +557,7 @@ int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK6 6
 
 int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus6, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus6, shift[DSIGMA];
    unsigned int h;
    if(m<6) return -1; 
    count = 0;
@@ -528,8 +566,7 @@ int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus6;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -573,9 +610,7 @@ int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -591,7 +626,7 @@ int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK7 7
 
 int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus7, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus7, shift[DSIGMA];
    unsigned int h;
    if(m<7) return -1; 
    count = 0;
@@ -600,8 +635,7 @@ int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
 
   sh = mMinus7;
   if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -649,9 +683,7 @@ int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -667,7 +699,7 @@ int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK8 8
 
 int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus8, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus8, shift[DSIGMA];
    unsigned int h;
    if(m<8) return -1; 
    count = 0;
@@ -676,8 +708,7 @@ int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus8;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -729,9 +760,7 @@ int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             //OUTPUT(i-mMinus1);
             ++count;
          }
@@ -748,7 +777,7 @@ int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK9 9
 
 int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus9, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus9, shift[DSIGMA];
    unsigned int h;
    if(m<9) return -1; 
    count = 0;
@@ -757,8 +786,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
 
   sh = mMinus9;
   if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -769,7 +797,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
    h = ((h<<1) + x[6]);
    h = ((h<<1) + x[7]);
    h = ((h<<1) + x[8]);
-   shift[h] = m-RANK9;
+   shift[h%DSIGMA] = m-RANK9;
    for (i=RANK9; i < mMinus1; ++i) {
       h = x[i-8];
       h = ((h<<1) + x[i-7]);
@@ -780,7 +808,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
       h = ((h<<1) + x[i-2]);
       h = ((h<<1) + x[i-1]);
       h = ((h<<1) + x[i]);
-      shift[h] = mMinus1-i;
+      shift[h%DSIGMA] = mMinus1-i;
    }   
    h = x[mMinus9];
    h = ((h<<1) + x[mMinus1-7]);
@@ -791,8 +819,8 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
    h = ((h<<1) + x[mMinus1-2]);
    h = ((h<<1) + x[mMinus1-1]);
    h = ((h<<1) + x[mMinus1]);
-   sh1 = shift[h];
-   shift[h] = 0;
+   sh1 = shift[h%DSIGMA];
+   shift[h%DSIGMA] = 0;
    if(sh1==0) sh1=1;
    END_PREPROCESSING
 
@@ -810,13 +838,11 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
          h = ((h<<1) + y[i-2]);
          h = ((h<<1) + y[i-1]);
          h = ((h<<1) + y[i]);
-         sh = shift[h];
+         sh = shift[h%DSIGMA];
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -832,7 +858,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK10 10
 
 int ohash10(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus10, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus10, shift[DSIGMA];
    unsigned int h;
    if(m<10) return -1; 
    count = 0;
@@ -841,8 +867,7 @@ int ohash10(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus10;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -902,9 +927,107 @@ int ohash10(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
+            ++count;
+         }
+         i+=sh1;
+      }
+      else {
+        END_SEARCHING
+        return count;
+      }
+   }
+}
+
+
+int ohashq(unsigned char *x, int m, unsigned char *y, int n, int q) {
+   int count, i, sh, sh1, mMinus1, mMinusQ, shift[DSIGMA];
+   unsigned int h;
+   if(m<q || q<=10) return -1;
+   count = 0;
+   mMinus1 = m-1;
+   mMinusQ = m-q;
+
+   sh = mMinusQ;
+   if (sh == 0) sh=1;
+   FILL(shift, sh, DSIGMA);
+
+   for (i=q-1; i < mMinus1; ++i) {
+      h = HQ(x+i-q+1, q);
+      shift[h] = mMinus1-i;
+   }
+   h = HQ(x+mMinusQ, q);
+   sh1 = shift[h];
+   shift[h] = 0;
+   if(sh1==0) sh1=1;
+   END_PREPROCESSING
+
+   BEGIN_SEARCHING
+   i = mMinus1;
+   while (1) {
+      sh = 1;
+      while (sh != 0) {
+         h = HQ(y+i-q+1, q);
+         sh = shift[h];
+         i+=sh;
+      }
+      if (i < n) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
+            ++count;
+         }
+         i+=sh1;
+      }
+      else {
+        END_SEARCHING
+        return count;
+      }
+   }
+}
+
+
+int ohashr(unsigned char *x, int m, unsigned char *y, int n, int q) {
+   int count, k, i, b, sh, sh1, mMinus1, mMinusQ, tsize, shift[DSIGMA];
+   unsigned int h;
+   unsigned char rank[ASIZE];
+   if(m<q) return -1;
+   b = buildRanks(x, m, rank);
+   if(b*q>16) return -1;
+   count = 0;
+   mMinus1 = m-1;
+   mMinusQ = m-q;
+   tsize = 1<<(b*q);
+
+   sh = mMinusQ;
+   if (sh == 0) sh=1;
+   FILL(shift, sh, tsize);
+
+   for (i=q-1; i < mMinus1; ++i) {
+      h = rank[x[i-q+1]];
+      for (k = q-2; k >= 0; --k)
+         h = ((h<<b) | rank[x[i-k]]);
+      shift[h] = mMinus1-i;
+   }
+   h = rank[x[mMinusQ]];
+   for (k = q-2; k >= 0; --k)
+      h = ((h<<b) | rank[x[mMinus1-k]]);
+   sh1 = shift[h];
+   shift[h] = 0;
+   if(sh1==0) sh1=1;
+   END_PREPROCESSING
+
+   BEGIN_SEARCHING
+   i = mMinus1;
+   while (1) {
+      sh = 1;
+      while (sh != 0) {
+         h = rank[y[i-q+1]];
+         for (k = q-2; k >= 0; --k)
+            h = ((h<<b) | rank[y[i-k]]);
+         sh = shift[h];
+         i+=sh;
+      }
+      if (i < n) {
+         if (VERIFY(x, y+i-mMinus1, mMinusQ)) {
             ++count;
          }
          i+=sh1;
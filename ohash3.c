@@ -21,12 +21,16 @@
 
 #include "include/define.h"
 #include "include/main.h"
+#include "ohash_isa.h"
 
 
 
 #define ASIZE 256
 #define DSIGMA 65536
+#define QMAX 64
+#define GOLDEN64 0x9E3779B97F4A7C15ULL
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 
 int HS(unsigned char *x, int i, int q) {
@@ -38,6 +42,22 @@ int HS(unsigned char *x, int i, int q) {
   return res%DSIGMA;
 }
 
+// Key of the q-gram starting at s for q > 10: the q bytes are read as
+// (overlapping) 64-bit words, mixed and folded to a DSIGMA index
+unsigned int HQ(unsigned char *s, int q) {
+  unsigned long long h, w;
+  int k;
+
+  h = 0;
+  for (k = 0; k < q-8; k += 8) {
+    memcpy(&w, s+k, 8);
+    h = (h ^ w) * GOLDEN64;
+  }
+  memcpy(&w, s+q-8, 8);
+  h = (h ^ w) * GOLDEN64;
+  return (unsigned int)(h>>48);
+}
+
 // Structure to store information of a suffix
 struct suffix {
   int index;
@@ -105,7 +125,7 @@ int computeMaxLCP(unsigned char *y, int n, int *SA) {
 
 
 int search(unsigned char *x, int m, unsigned char *y, int n) {
-  int i, count, j;
+  int i, count, qmax;
   int z[DSIGMA], hs;
 
   BEGIN_PREPROCESSING
@@ -122,7 +142,7 @@ int search(unsigned char *x, int m, unsigned char *y, int n) {
     case 2 :
       return ohash2(x, m, y, n);
     case 3 :
-      return ohash3(x, m, y, n);
+      return phash3(x, m, y, n);
     case 4 :
     case 5 :
     case 6 :
@@ -132,6 +152,21 @@ int search(unsigned char *x, int m, unsigned char *y, int n) {
     case 10 :
       return hash3(x, m, y, n);
     default :
+      // long repeats: look for a collision-free q, keeping q-grams
+      // short enough to allow long shifts
+      qmax = MIN(QMAX, m/2);
+      while (q <= qmax) {
+        memset(z, -1, DSIGMA*sizeof(int));
+        for (i = 0; i < m-q+1; ++i) {
+          hs = HQ(x+i, q);
+          if (z[hs] == -1) z[hs] = i;
+          else break;
+        }
+        if (i >= m-q+1) break;
+        else ++q;
+      }
+      if (q <= qmax)
+        return ohashq(x, m, y, n, q);
       return hash8(x, m, y, n);
   }
 }
@@ -140,15 +175,14 @@ int search(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK8 8
 
 int hash8(unsigned char *x, int m, unsigned char *y, int n) {
-   int i, j, sh, shift[WSIZE], sh1, mMinus1, mMinus7, count;
+   int i, sh, shift[WSIZE], sh1, mMinus1, mMinus7, count;
    unsigned int h;
    if(m<8) return -1;
 
    count = 0;
    mMinus1 = m-1;
    mMinus7 = m-7;
-   for (i = 0; i < WSIZE; ++i)
-      shift[i] = mMinus7;
+   FILL(shift, mMinus7, WSIZE);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -202,9 +236,7 @@ int hash8(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             OUTPUT(i-mMinus1);
          }
          i+=sh1;
@@ -218,14 +250,13 @@ int hash8(unsigned char *x, int m, unsigned char *y, int n) {
 
 
 int ohash1(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus2, shift[ASIZE];
+   int count, i, sh, sh1, mMinus1, mMinus2, shift[ASIZE];
    unsigned char h;
    if(m<2) return -1;
    count = 0;
    mMinus1 = m-1;
 
-   for (i = 0; i < ASIZE; ++i)
-      shift[i] = m;
+   FILL(shift, m, ASIZE);
 
    h = x[0];
    shift[h] = mMinus1;
@@ -247,9 +278,7 @@ int ohash1(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<mMinus1 && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=mMinus1) {
+         if (VERIFY(x, y+i-mMinus1, mMinus1)) {
             ++count;
          }
          i+=sh1;
@@ -265,7 +294,7 @@ int ohash1(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK2 2
 
 int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus2, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus2, shift[DSIGMA];
    unsigned int h;
    if(m<2) return -1; 
    count = 0;
@@ -274,8 +303,7 @@ int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus2;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<8) + x[1]);
@@ -303,9 +331,7 @@ int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<mMinus2 && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=mMinus2) {
+         if (VERIFY(x, y+i-mMinus1, mMinus2)) {
             ++count;
          }
          i+=sh1;
@@ -321,7 +347,7 @@ int ohash2(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK3 3
 
 int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus3, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus3, shift[DSIGMA];
    unsigned int h;
    if(m<3) return -1; 
    count = 0;
@@ -330,8 +356,7 @@ int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus3;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -363,9 +388,7 @@ int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -381,7 +404,7 @@ int ohash3(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK4 4
 
 int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus4, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus4, shift[DSIGMA];
    unsigned int h;
    if(m<4) return -1; 
    count = 0;
@@ -390,8 +413,7 @@ int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus4;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -427,9 +449,7 @@ int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -445,7 +465,7 @@ int ohash4(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK5 5
 
 int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus5, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus5, shift[DSIGMA];
    unsigned int h;
    if(m<5) return -1; 
    count = 0;
@@ -454,8 +474,7 @@ int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus5;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -495,9 +514,7 @@ int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -513,7 +530,7 @@ int ohash5(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK6 6
 
 int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus6, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus6, shift[DSIGMA];
    unsigned int h;
    if(m<6) return -1; 
    count = 0;
@@ -522,8 +539,7 @@ int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus6;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -567,9 +583,7 @@ int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -585,7 +599,7 @@ int ohash6(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK7 7
 
 int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus7, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus7, shift[DSIGMA];
    unsigned int h;
    if(m<7) return -1; 
    count = 0;
@@ -594,8 +608,7 @@ int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus7;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -643,9 +656,7 @@ int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -661,7 +672,7 @@ int ohash7(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK8 8
 
 int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus8, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus8, shift[DSIGMA];
    unsigned int h;
    if(m<8) return -1; 
    count = 0;
@@ -670,8 +681,7 @@ int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus8;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -723,9 +733,7 @@ int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -741,7 +749,7 @@ int ohash8(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK9 9
 
 int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus9, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus9, shift[DSIGMA];
    unsigned int h;
    if(m<9) return -1; 
    count = 0;
@@ -750,8 +758,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus9;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -762,7 +769,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
    h = ((h<<1) + x[6]);
    h = ((h<<1) + x[7]);
    h = ((h<<1) + x[8]);
-   shift[h] = m-RANK9;
+   shift[h%DSIGMA] = m-RANK9;
    for (i=RANK9; i < mMinus1; ++i) {
       h = x[i-8];
       h = ((h<<1) + x[i-7]);
@@ -773,7 +780,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
       h = ((h<<1) + x[i-2]);
       h = ((h<<1) + x[i-1]);
       h = ((h<<1) + x[i]);
-      shift[h] = mMinus1-i;
+      shift[h%DSIGMA] = mMinus1-i;
    }   
    h = x[mMinus9];
    h = ((h<<1) + x[mMinus1-7]);
@@ -784,8 +791,8 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
    h = ((h<<1) + x[mMinus1-2]);
    h = ((h<<1) + x[mMinus1-1]);
    h = ((h<<1) + x[mMinus1]);
-   sh1 = shift[h];
-   shift[h] = 0;
+   sh1 = shift[h%DSIGMA];
+   shift[h%DSIGMA] = 0;
    if(sh1==0) sh1=1;
    END_PREPROCESSING
 
@@ -803,13 +810,11 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
          h = ((h<<1) + y[i-2]);
          h = ((h<<1) + y[i-1]);
          h = ((h<<1) + y[i]);
-         sh = shift[h];
+         sh = shift[h%DSIGMA];
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -825,7 +830,7 @@ int ohash9(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK10 10
 
 int ohash10(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus10, shift[DSIGMA];
+   int count, i, sh, sh1, mMinus1, mMinus10, shift[DSIGMA];
    unsigned int h;
    if(m<10) return -1; 
    count = 0;
@@ -834,8 +839,7 @@ int ohash10(unsigned char *x, int m, unsigned char *y, int n) {
 
    sh = mMinus10;
    if (sh == 0) sh=1;
-   for (i = 0; i < DSIGMA; ++i)
-      shift[i] = sh;
+   FILL(shift, sh, DSIGMA);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -895,9 +899,7 @@ int ohash10(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             ++count;
          }
          i+=sh1;
@@ -913,15 +915,14 @@ int ohash10(unsigned char *x, int m, unsigned char *y, int n) {
 #define RANK3 3
 
 int hash3(unsigned char *x, int m, unsigned char *y, int n) {
-   int count, j, i, sh, sh1, mMinus1, mMinus2, shift[WSIZE];
+   int count, i, sh, sh1, mMinus1, mMinus2, shift[WSIZE];
    unsigned char h;
    if(m<3) return -1;
    count = 0;
    mMinus1 = m-1;
    mMinus2 = m-2;
 
-   for (i = 0; i < WSIZE; ++i)
-      shift[i] = mMinus2;
+   FILL(shift, mMinus2, WSIZE);
 
    h = x[0];
    h = ((h<<1) + x[1]);
@@ -955,9 +956,7 @@ int hash3(unsigned char *x, int m, unsigned char *y, int n) {
          i+=sh;
       }
       if (i < n) {
-         j=0;
-         while(j<m && x[j]==y[i-mMinus1+j]) j++;
-         if (j>=m) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
             OUTPUT(i-mMinus1);
          }
          i+=sh1;
@@ -968,3 +967,111 @@ int hash3(unsigned char *x, int m, unsigned char *y, int n) {
       }
    }
 }
+
+
+int phash3(unsigned char *x, int m, unsigned char *y, int n) {
+   int count, i, sh, sh0, sh1, mMinus1, mMinus3, rows, *row;
+   unsigned int h, bits[DSIGMA/32];
+   unsigned short slot[DSIGMA];
+   if(m<3) return -1;
+   count = 0;
+   mMinus1 = m-1;
+   mMinus3 = m-3;
+
+   // first level: bitmap of the bigrams ending a trigram of x, each
+   // one owning a row of the second level indexed by the first symbol
+   memset(bits, 0, sizeof(bits));
+   rows = 0;
+   for (i=2; i < m; ++i) {
+      h = (x[i-1]<<8) | x[i];
+      if (!(bits[h>>5] & (1U<<(h&31)))) {
+         bits[h>>5] |= 1U<<(h&31);
+         slot[h] = rows++;
+      }
+   }
+   sh0 = mMinus3;
+   if (sh0 == 0) sh0=1;
+   row = (int *)malloc(rows*ASIZE*sizeof(int));
+   if (row == NULL) return -1;
+   FILL(row, sh0, rows*ASIZE);
+
+   for (i=2; i < mMinus1; ++i) {
+      h = (x[i-1]<<8) | x[i];
+      row[slot[h]*ASIZE + x[i-2]] = mMinus1-i;
+   }
+   h = (x[mMinus1-1]<<8) | x[mMinus1];
+   h = slot[h]*ASIZE + x[mMinus3];
+   sh1 = row[h];
+   row[h] = 0;
+   if(sh1==0) sh1=1;
+   END_PREPROCESSING
+
+   BEGIN_SEARCHING
+   i = mMinus1;
+   while (1) {
+      sh = 1;
+      while (sh != 0) {
+         h = (y[i-1]<<8) | y[i];
+         if (bits[h>>5] & (1U<<(h&31)))
+            sh = row[slot[h]*ASIZE + y[i-2]];
+         else
+            sh = sh0;
+         i+=sh;
+      }
+      if (i < n) {
+         if (VERIFY(x, y+i-mMinus1, mMinus3)) {
+            ++count;
+         }
+         i+=sh1;
+      }
+      else {
+        END_SEARCHING
+        free(row);
+        return count;
+      }
+   }
+}
+
+int ohashq(unsigned char *x, int m, unsigned char *y, int n, int q) {
+   int count, i, sh, sh1, mMinus1, mMinusQ, shift[DSIGMA];
+   unsigned int h;
+   if(m<q || q<=10) return -1;
+   count = 0;
+   mMinus1 = m-1;
+   mMinusQ = m-q;
+
+   sh = mMinusQ;
+   if (sh == 0) sh=1;
+   FILL(shift, sh, DSIGMA);
+
+   for (i=q-1; i < mMinus1; ++i) {
+      h = HQ(x+i-q+1, q);
+      shift[h] = mMinus1-i;
+   }
+   h = HQ(x+mMinusQ, q);
+   sh1 = shift[h];
+   shift[h] = 0;
+   if(sh1==0) sh1=1;
+   END_PREPROCESSING
+
+   BEGIN_SEARCHING
+   i = mMinus1;
+   while (1) {
+      sh = 1;
+      while (sh != 0) {
+         h = HQ(y+i-q+1, q);
+         sh = shift[h];
+         i+=sh;
+      }
+      if (i < n) {
+         if (VERIFY(x, y+i-mMinus1, m)) {
+            ++count;
+         }
+         i+=sh1;
+      }
+      else {
+        END_SEARCHING
+        return count;
+      }
+   }
+}
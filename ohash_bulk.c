@@ -0,0 +1,160 @@
+/*
+ * ohash_bulk: compilation of large pattern sets by a pool of threads.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ohash_bulk.h"
+
+#define BATCH 256
+#define SLAB (16<<20)
+
+struct pool {
+  unsigned char **x;
+  const int *m;
+  int count;
+  int strategy;
+  int next;                 // first pattern not taken
+  int error;
+  ohash_bulk *b;
+  pthread_mutex_t lock;     // slab list and error
+};
+
+struct worker {
+  struct pool *pool;
+  unsigned char *slab;      // current slab
+  size_t used, size;
+};
+
+// Returns the slab of len bytes, NULL if out of memory
+static void *newSlab(struct pool *pool, size_t len) {
+  ohash_bulk *b = pool->b;
+  void **slab, *r;
+
+  r = malloc(len);
+  if (r == NULL) return NULL;
+  pthread_mutex_lock(&pool->lock);
+  slab = (void **)realloc(b->slab, (b->nslabs+1)*sizeof(void *));
+  if (slab != NULL) {
+    b->slab = slab;
+    b->slab[b->nslabs++] = r;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  if (slab == NULL) {
+    free(r);
+    return NULL;
+  }
+  return r;
+}
+
+// The pattern is compiled at the end of the slab, whose free space also
+// holds the suffix array meanwhile, then the slab moves past its tables
+static int compileOne(struct worker *w, int i) {
+  struct pool *pool = w->pool;
+  ohash_pattern *p;
+  size_t need;
+
+  if (pool->m[i] < 1) return 0;
+  need = ohash_workspace_size(pool->m[i]);
+  if (need > w->size-w->used) {
+    w->size = need > SLAB ? need : SLAB;
+    w->slab = (unsigned char *)newSlab(pool, w->size);
+    w->used = 0;
+    if (w->slab == NULL) {
+      w->size = 0;
+      return -1;
+    }
+  }
+  p = ohash_compile_in(w->slab+w->used, w->size-w->used, pool->x[i], pool->m[i], pool->strategy);
+  if (p == NULL) return -1;
+  w->used += ohash_pattern_size(p);
+  pool->b->pattern[i] = p;
+  return 0;
+}
+
+static void *work(void *arg) {
+  struct worker *w = (struct worker *)arg;
+  struct pool *pool = w->pool;
+  int i, end;
+
+  while (1) {
+    i = __atomic_fetch_add(&pool->next, BATCH, __ATOMIC_RELAXED);
+    if (i >= pool->count || __atomic_load_n(&pool->error, __ATOMIC_RELAXED)) break;
+    end = i+BATCH < pool->count ? i+BATCH : pool->count;
+    for (; i < end; ++i)
+      if (compileOne(w, i) < 0) {
+        __atomic_store_n(&pool->error, 1, __ATOMIC_RELAXED);
+        break;
+      }
+  }
+  return NULL;
+}
+
+int ohash_compile_bulk(ohash_bulk *b, unsigned char **x, const int *m, int count,
+                       int strategy, int threads) {
+  struct worker *w;
+  struct pool pool;
+  pthread_t *tid;
+  int t, started;
+
+  memset(b, 0, sizeof(*b));
+  if (threads < 1) threads = 1;
+  b->count = count;
+  b->pattern = (ohash_pattern **)calloc(count > 0 ? count : 1, sizeof(ohash_pattern *));
+  w = (struct worker *)calloc(threads, sizeof(struct worker));
+  tid = (pthread_t *)malloc(threads*sizeof(pthread_t));
+  if (b->pattern == NULL || w == NULL || tid == NULL) {
+    free(w);
+    free(tid);
+    ohash_bulk_free(b);
+    return -1;
+  }
+  memset(&pool, 0, sizeof(pool));
+  pool.x = x;
+  pool.m = m;
+  pool.count = count;
+  pool.strategy = strategy;
+  pool.b = b;
+  pthread_mutex_init(&pool.lock, NULL);
+
+  // the calling thread is the last worker
+  for (started = 0; started < threads-1; ++started) {
+    w[started].pool = &pool;
+    if (pthread_create(&tid[started], NULL, work, &w[started]) != 0) break;
+  }
+  w[started].pool = &pool;
+  work(&w[started]);
+  for (t = 0; t < started; ++t)
+    pthread_join(tid[t], NULL);
+  pthread_mutex_destroy(&pool.lock);
+  free(w);
+  free(tid);
+  if (pool.error) {
+    ohash_bulk_free(b);
+    return -1;
+  }
+  return 0;
+}
+
+void ohash_bulk_free(ohash_bulk *b) {
+  int i;
+
+  for (i = 0; i < b->nslabs; ++i)
+    free(b->slab[i]);
+  free(b->slab);
+  free(b->pattern);
+  memset(b, 0, sizeof(*b));
+}
@@ -0,0 +1,49 @@
+/*
+ * ohash_bulk: compilation of large pattern sets by a pool of threads.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Workers take the patterns by batches. Each one compiles them one after
+ * the other into a slab of its own with ohash_compile_in(), the free end
+ * of the slab serving as scratch space for the suffix sort, so that the
+ * compiled set lies in a few large contiguous blocks and nothing is
+ * allocated per pattern.
+ */
+
+#ifndef OHASH_BULK_H
+#define OHASH_BULK_H
+
+#include "ohash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ohash_bulk {
+  int count;
+  ohash_pattern **pattern;  // NULL where m < 1
+  int nslabs;
+  void **slab;
+} ohash_bulk;
+
+// Compiles x[i][0..m[i]-1] for i < count with threads workers. Returns 0,
+// or -1 if out of memory
+int ohash_compile_bulk(ohash_bulk *b, unsigned char **x, const int *m, int count,
+                       int strategy, int threads);
+void ohash_bulk_free(ohash_bulk *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * ohash_cache: a shared cache of compiled patterns.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ohash_cache.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+struct entry {
+  ohash_pattern *p;
+  int strategy;             // asked for, may be OHASH_AUTO
+  unsigned long long key;
+  size_t bytes;
+  int refs;                 // taken and not given back
+  int cached;               // 0 once evicted
+  struct entry *chain;      // bucket
+  struct entry *prev, *next;  // LRU list, most recent first
+  struct shard *shard;
+};
+
+struct shard {
+  pthread_mutex_t lock;
+  struct entry **bucket;
+  size_t nbuckets;          // power of two
+  size_t entries;
+  size_t bytes, limit;
+  struct entry *head, *tail;
+  long long hits, misses, evictions;
+};
+
+struct ohash_cache {
+  int nshards;
+  struct shard *shard;
+};
+
+static unsigned long long keyOf(unsigned char *x, int m, int strategy) {
+  unsigned long long h;
+  int i;
+
+  h = FNV_OFFSET ^ (unsigned)strategy;
+  for (i = 0; i < m; ++i)
+    h = (h ^ x[i]) * FNV_PRIME;
+  return h;
+}
+
+ohash_cache *ohash_cache_new(size_t bytes, int shards) {
+  ohash_cache *c;
+  int i;
+
+  if (shards < 1) shards = 1;
+  c = (ohash_cache *)malloc(sizeof(ohash_cache));
+  if (c == NULL) return NULL;
+  c->nshards = shards;
+  c->shard = (struct shard *)calloc(shards, sizeof(struct shard));
+  if (c->shard == NULL) {
+    free(c);
+    return NULL;
+  }
+  for (i = 0; i < shards; ++i) {
+    pthread_mutex_init(&c->shard[i].lock, NULL);
+    c->shard[i].limit = bytes/shards;
+  }
+  return c;
+}
+
+void ohash_cache_free(ohash_cache *c) {
+  struct entry *e, *next;
+  int i;
+
+  if (c == NULL) return;
+  for (i = 0; i < c->nshards; ++i) {
+    for (e = c->shard[i].head; e != NULL; e = next) {
+      next = e->next;
+      ohash_free(e->p);
+      free(e);
+    }
+    free(c->shard[i].bucket);
+    pthread_mutex_destroy(&c->shard[i].lock);
+  }
+  free(c->shard);
+  free(c);
+}
+
+// The functions below are called with the lock of s held
+
+static struct entry *lookup(struct shard *s, unsigned long long key, unsigned char *x, int m, int strategy) {
+  struct entry *e;
+
+  if (s->nbuckets == 0) return NULL;
+  for (e = s->bucket[key & (s->nbuckets-1)]; e != NULL; e = e->chain)
+    if (e->key == key && e->strategy == strategy && e->p->m == m && memcmp(e->p->x, x, m) == 0)
+      return e;
+  return NULL;
+}
+
+static void toFront(struct shard *s, struct entry *e) {
+  e->prev = NULL;
+  e->next = s->head;
+  if (s->head != NULL) s->head->prev = e;
+  else s->tail = e;
+  s->head = e;
+}
+
+static void detach(struct shard *s, struct entry *e) {
+  if (e->prev != NULL) e->prev->next = e->next;
+  else s->head = e->next;
+  if (e->next != NULL) e->next->prev = e->prev;
+  else s->tail = e->prev;
+}
+
+// Doubles the table when it is full. Returns -1 if out of memory
+static int grow(struct shard *s) {
+  struct entry **bucket, *e, *next;
+  size_t n, i;
+
+  if (s->entries < s->nbuckets) return 0;
+  n = s->nbuckets ? 2*s->nbuckets : 64;
+  bucket = (struct entry **)calloc(n, sizeof(struct entry *));
+  if (bucket == NULL) return -1;
+  for (i = 0; i < s->nbuckets; ++i)
+    for (e = s->bucket[i]; e != NULL; e = next) {
+      next = e->chain;
+      e->chain = bucket[e->key & (n-1)];
+      bucket[e->key & (n-1)] = e;
+    }
+  free(s->bucket);
+  s->bucket = bucket;
+  s->nbuckets = n;
+  return 0;
+}
+
+// Takes e out of the cache; it is freed now, or by the last put
+static void evict(struct shard *s, struct entry *e) {
+  struct entry **q;
+
+  for (q = &s->bucket[e->key & (s->nbuckets-1)]; *q != e; q = &(*q)->chain);
+  *q = e->chain;
+  detach(s, e);
+  s->entries--;
+  s->bytes -= e->bytes;
+  s->evictions++;
+  e->cached = 0;
+  if (e->refs == 0) {
+    ohash_free(e->p);
+    free(e);
+  }
+}
+
+ohash_pattern *ohash_cache_get(ohash_cache *c, unsigned char *x, int m, int strategy) {
+  unsigned long long key;
+  struct entry *e, *old;
+  struct shard *s;
+  ohash_pattern *p;
+
+  if (m < 1) return NULL;
+  key = keyOf(x, m, strategy);
+  s = &c->shard[(key>>32) % c->nshards];
+  pthread_mutex_lock(&s->lock);
+  e = lookup(s, key, x, m, strategy);
+  if (e != NULL) {
+    s->hits++;
+    e->refs++;
+    detach(s, e);
+    toFront(s, e);
+    pthread_mutex_unlock(&s->lock);
+    return e->p;
+  }
+  s->misses++;
+  pthread_mutex_unlock(&s->lock);
+
+  p = ohash_compile(x, m, strategy);
+  e = (struct entry *)calloc(1, sizeof(struct entry));
+  if (p == NULL || e == NULL) {
+    ohash_free(p);
+    free(e);
+    return NULL;
+  }
+  e->p = p;
+  e->strategy = strategy;
+  e->key = key;
+  e->bytes = ohash_pattern_size(p);
+  e->refs = 1;
+  e->shard = s;
+  p->owner = e;
+
+  pthread_mutex_lock(&s->lock);
+  old = lookup(s, key, x, m, strategy);
+  if (old != NULL) {
+    // compiled by another thread meanwhile
+    old->refs++;
+    pthread_mutex_unlock(&s->lock);
+    ohash_free(p);
+    free(e);
+    return old->p;
+  }
+  if (e->bytes <= s->limit && grow(s) == 0) {
+    while (s->bytes+e->bytes > s->limit)
+      evict(s, s->tail);
+    e->chain = s->bucket[key & (s->nbuckets-1)];
+    s->bucket[key & (s->nbuckets-1)] = e;
+    toFront(s, e);
+    s->entries++;
+    s->bytes += e->bytes;
+    e->cached = 1;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return p;
+}
+
+void ohash_cache_put(ohash_cache *c, ohash_pattern *p) {
+  struct entry *e;
+  struct shard *s;
+  int last;
+
+  (void)c;
+  if (p == NULL) return;
+  e = (struct entry *)p->owner;
+  s = e->shard;
+  pthread_mutex_lock(&s->lock);
+  last = --e->refs == 0 && !e->cached;
+  pthread_mutex_unlock(&s->lock);
+  if (last) {
+    ohash_free(p);
+    free(e);
+  }
+}
+
+void ohash_cache_stats(ohash_cache *c, struct ohash_cache_stats *st) {
+  struct shard *s;
+  int i;
+
+  memset(st, 0, sizeof(*st));
+  for (i = 0; i < c->nshards; ++i) {
+    s = &c->shard[i];
+    pthread_mutex_lock(&s->lock);
+    st->hits += s->hits;
+    st->misses += s->misses;
+    st->evictions += s->evictions;
+    st->entries += s->entries;
+    st->bytes += s->bytes;
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+long long ohash_cache_search(ohash_cache *c, unsigned char *x, int m, unsigned char *y, size_t n) {
+  ohash_pattern *p;
+  long long count;
+
+  p = ohash_cache_get(c, x, m, OHASH_AUTO);
+  if (p == NULL) return -1;
+  count = ohash_exec(p, y, n);
+  ohash_cache_put(c, p);
+  return count;
+}
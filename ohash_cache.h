@@ -0,0 +1,62 @@
+/*
+ * ohash_cache: a shared cache of compiled patterns.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Patterns are keyed by their bytes and the strategy asked for, and
+ * spread over shards, each one with its own lock, hash table and least
+ * recently used list. A shard keeps its patterns under its share of the
+ * memory bound. A pattern taken with ohash_cache_get() stays valid until
+ * it is given back with ohash_cache_put(), even if it is evicted
+ * meanwhile. Patterns are compiled outside the locks.
+ */
+
+#ifndef OHASH_CACHE_H
+#define OHASH_CACHE_H
+
+#include "ohash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ohash_cache ohash_cache;
+
+struct ohash_cache_stats {
+  long long hits;
+  long long misses;
+  long long evictions;
+  long long entries;
+  long long bytes;          // tables and copies of the patterns
+};
+
+// A cache of at most bytes of patterns, over shards locks. NULL if out
+// of memory
+ohash_cache *ohash_cache_new(size_t bytes, int shards);
+// Frees the cache, once every pattern taken has been given back
+void ohash_cache_free(ohash_cache *c);
+// Compiled x[0..m-1], from the cache or compiled and added to it. NULL
+// if m < 1 or out of memory
+ohash_pattern *ohash_cache_get(ohash_cache *c, unsigned char *x, int m, int strategy);
+void ohash_cache_put(ohash_cache *c, ohash_pattern *p);
+// Sum of the counters of the shards
+void ohash_cache_stats(ohash_cache *c, struct ohash_cache_stats *s);
+
+// ohash_search() through the cache
+long long ohash_cache_search(ohash_cache *c, unsigned char *x, int m, unsigned char *y, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
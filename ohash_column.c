@@ -0,0 +1,95 @@
+/*
+ * ohash_column: search of a pattern in every row of a string column.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ohash_column.h"
+
+struct column {
+  const int32_t *o32;       // offsets, one of the two
+  const int64_t *o64;
+  long long first;          // offsets[0]
+  long long rows;
+  long long row;            // row of the last occurrence
+  long long last;           // last row selected, -1 if none
+  long long selected;
+  int m;
+  unsigned char *bitmap;
+  int64_t *counts;
+};
+
+// End of row r, from the start of the searched text
+static long long endOf(struct column *c, long long r) {
+  return (c->o32 != NULL ? c->o32[r+1] : c->o64[r+1]) - c->first;
+}
+
+// Occurrences come in increasing order, so the rows are walked once
+static long long onRow(void *ctx, long long pos) {
+  struct column *c = (struct column *)ctx;
+  long long end;
+
+  while (c->row < c->rows && endOf(c, c->row) <= pos) c->row++;
+  if (c->row == c->rows) return -1;
+  end = endOf(c, c->row);
+  if (pos+c->m > end) return pos+1;
+  if (c->last != c->row) {
+    c->last = c->row;
+    c->selected++;
+    if (c->bitmap != NULL) c->bitmap[c->row>>3] |= 1U<<(c->row&7);
+  }
+  if (c->counts == NULL) return end;
+  c->counts[c->row]++;
+  return pos+1;
+}
+
+static long long search(ohash_pattern *p, struct column *c, const unsigned char *data,
+                        long long first, long long stop, unsigned char *bitmap, int64_t *counts) {
+  if (stop < first) return -1;
+  c->first = first;
+  c->row = 0;
+  c->last = -1;
+  c->selected = 0;
+  c->m = p->m;
+  c->bitmap = bitmap;
+  c->counts = counts;
+  if (bitmap != NULL) memset(bitmap, 0, (c->rows+7)/8);
+  if (counts != NULL) memset(counts, 0, c->rows*sizeof(int64_t));
+  if (c->rows > 0)
+    ohash_scan(p, (unsigned char *)data+first, stop-first, onRow, c);
+  return c->selected;
+}
+
+long long ohash_column(ohash_pattern *p, const int32_t *offsets, const unsigned char *data,
+                       long long rows, unsigned char *bitmap, int64_t *counts) {
+  struct column c;
+
+  if (rows < 0) return -1;
+  c.o32 = offsets;
+  c.o64 = NULL;
+  c.rows = rows;
+  return search(p, &c, data, offsets[0], offsets[rows], bitmap, counts);
+}
+
+long long ohash_column64(ohash_pattern *p, const int64_t *offsets, const unsigned char *data,
+                         long long rows, unsigned char *bitmap, int64_t *counts) {
+  struct column c;
+
+  if (rows < 0) return -1;
+  c.o32 = NULL;
+  c.o64 = offsets;
+  c.rows = rows;
+  return search(p, &c, data, offsets[0], offsets[rows], bitmap, counts);
+}
@@ -0,0 +1,51 @@
+/*
+ * ohash_column: search of a pattern in every row of a string column.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * The column is laid out as in Apache Arrow: row r is
+ * data[offsets[r]..offsets[r+1]-1], the offsets do not decrease, and
+ * they need not start at 0 (slices). The rows are contiguous, so the
+ * whole of data[offsets[0]..offsets[rows]-1] is searched in one pass
+ * with ohash_scan(), and each occurrence is given to the row it falls
+ * in; occurrences across two rows are dropped. Short rows thus cost no
+ * call of their own, and data is never written.
+ */
+
+#ifndef OHASH_COLUMN_H
+#define OHASH_COLUMN_H
+
+#include <stdint.h>
+#include "ohash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Finds p in the rows of the column. If bitmap is not NULL, bit r%8 of
+// bitmap[r/8] is set for the rows holding p and cleared for the others
+// (Arrow bit order, (rows+7)/8 bytes); if counts is not NULL, counts[r]
+// is the number of occurrences in row r, otherwise the search goes on
+// at the next row after an occurrence. Returns the number of rows
+// holding p, or -1 if rows < 0 or offsets[rows] < offsets[0]
+long long ohash_column(ohash_pattern *p, const int32_t *offsets, const unsigned char *data,
+                       long long rows, unsigned char *bitmap, int64_t *counts);
+// Same with 64-bit offsets (Arrow large strings)
+long long ohash_column64(ohash_pattern *p, const int64_t *offsets, const unsigned char *data,
+                         long long rows, unsigned char *bitmap, int64_t *counts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * ohash_cursor: a search that can be suspended and resumed.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <time.h>
+#include "ohash_cursor.h"
+
+// Bytes searched between two readings of the clock
+#define SLICE (256<<10)
+
+// Passes the occurrences of a step on with their offsets in y
+struct relay {
+  ohash_report report;
+  void *ctx;
+  size_t base;
+  long long next;           // where report asked to go on, in y
+};
+
+static long long relay(void *ctx, long long pos) {
+  struct relay *r = (struct relay *)ctx;
+
+  r->next = r->report(r->ctx, r->base+pos);
+  if (r->next < 0) return -1;
+  return r->next-(long long)r->base;
+}
+
+void ohash_cursor_init(ohash_cursor *c, ohash_pattern *p, unsigned char *y, size_t n) {
+  c->p = p;
+  c->y = y;
+  c->n = n;
+  c->pos = 0;
+  c->count = 0;
+  c->done = n < (size_t)p->m;
+}
+
+int ohash_cursor_step(ohash_cursor *c, size_t budget, ohash_report report, void *ctx) {
+  struct relay r;
+  size_t end, stop;
+
+  if (c->done) return 0;
+  // at least one window, so that a caller looping on the step ends
+  if (budget == 0) budget = 1;
+  // windows starting in [pos, end), which end before stop
+  end = budget < c->n-c->pos ? c->pos+budget : c->n;
+  stop = end+c->p->m-1 < c->n ? end+c->p->m-1 : c->n;
+  if (report == NULL)
+    c->count += ohash_scan(c->p, c->y+c->pos, stop-c->pos, NULL, NULL);
+  else {
+    r.report = report;
+    r.ctx = ctx;
+    r.base = c->pos;
+    r.next = 0;
+    c->count += ohash_scan(c->p, c->y+c->pos, stop-c->pos, relay, &r);
+    if (r.next < 0) c->done = 1;
+    else if ((size_t)r.next > end) end = (size_t)r.next;
+  }
+  c->pos = end;
+  if (c->pos >= c->n || c->n-c->pos < (size_t)c->p->m) c->done = 1;
+  return !c->done;
+}
+
+int ohash_cursor_until(ohash_cursor *c, long long deadline, ohash_report report, void *ctx) {
+  struct timespec t;
+
+  while (ohash_cursor_step(c, SLICE, report, ctx)) {
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    if (t.tv_sec*1000000000LL + t.tv_nsec >= deadline) return 1;
+  }
+  return 0;
+}
+
+void ohash_cursor_cancel(ohash_cursor *c) {
+  c->done = 1;
+}
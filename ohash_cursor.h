@@ -0,0 +1,61 @@
+/*
+ * ohash_cursor: a search that can be suspended and resumed.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * An event loop cannot wait for the search of a large buffer. A cursor
+ * keeps where the search of y[0..n-1] stands, and each call searches the
+ * windows starting in the next bytes only, within a byte budget or until
+ * a deadline, with the kernels of ohash_scan(). The windows of a call
+ * end at most m-1 bytes after its budget, so nothing is carried over
+ * and each occurrence is reported once. The cursor is a plain structure
+ * that holds no resource: it may live in a coroutine frame and be
+ * dropped at any time.
+ */
+
+#ifndef OHASH_CURSOR_H
+#define OHASH_CURSOR_H
+
+#include "ohash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ohash_cursor {
+  ohash_pattern *p;
+  unsigned char *y;
+  size_t n;
+  size_t pos;               // first window not searched yet
+  long long count;          // occurrences reported so far
+  int done;                 // end of y reached, stopped by report or cancelled
+} ohash_cursor;
+
+// Starts a search of p in y[0..n-1], which is never written
+void ohash_cursor_init(ohash_cursor *c, ohash_pattern *p, unsigned char *y, size_t n);
+// Searches the windows starting in the next budget bytes, passing their
+// occurrences (offsets in y) to report if not NULL; report returning -1
+// ends the search. A budget of 0 counts as 1. Returns 1 while windows
+// are left, 0 when done
+int ohash_cursor_step(ohash_cursor *c, size_t budget, ohash_report report, void *ctx);
+// Same by steps until the search is done or the CLOCK_MONOTONIC time
+// deadline (in nanoseconds) is passed
+int ohash_cursor_until(ohash_cursor *c, long long deadline, ohash_report report, void *ctx);
+// Ends the search; the next steps return 0
+void ohash_cursor_cancel(ohash_cursor *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
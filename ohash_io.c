@@ -0,0 +1,300 @@
+/*
+ * ohash_io: batched reads through io_uring, with a pread() fallback.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * The rings are driven with the raw system calls, so there is no
+ * dependency on liburing.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "ohash_io.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_SINGLE_MMAP)
+#define HAVE_URING
+#endif
+#endif
+
+
+#ifdef HAVE_URING
+
+static void uringInit(struct ohio *io) {
+  struct io_uring_params p;
+  char *sq, *cq;
+  int fd;
+
+  memset(&p, 0, sizeof(p));
+  fd = syscall(__NR_io_uring_setup, io->depth, &p);
+  if (fd < 0) return;
+  io->sqSize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  io->cqSize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (io->cqSize > io->sqSize) io->sqSize = io->cqSize;
+    io->cqSize = 0;
+  }
+  io->sqesSize = p.sq_entries*sizeof(struct io_uring_sqe);
+  sq = cq = mmap(NULL, io->sqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) goto fail;
+  if (io->cqSize > 0) {
+    cq = mmap(NULL, io->cqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) {
+      munmap(sq, io->sqSize);
+      goto fail;
+    }
+  }
+  io->sqes = mmap(NULL, io->sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (io->sqes == MAP_FAILED) {
+    if (io->cqSize > 0) munmap(cq, io->cqSize);
+    munmap(sq, io->sqSize);
+    goto fail;
+  }
+  io->sqRing = sq;
+  io->cqRing = cq;
+  io->sqHead = (unsigned *)(sq+p.sq_off.head);
+  io->sqTail = (unsigned *)(sq+p.sq_off.tail);
+  io->sqMask = (unsigned *)(sq+p.sq_off.ring_mask);
+  io->sqArray = (unsigned *)(sq+p.sq_off.array);
+  io->cqHead = (unsigned *)(cq+p.cq_off.head);
+  io->cqTail = (unsigned *)(cq+p.cq_off.tail);
+  io->cqMask = (unsigned *)(cq+p.cq_off.ring_mask);
+  io->cqes = cq+p.cq_off.cqes;
+  io->ring = fd;
+  return;
+
+fail:
+  close(fd);
+}
+
+// Puts the rest of request r in the submission ring
+static void uringPush(struct ohio *io, int r) {
+  struct io_uring_sqe *sqe;
+  struct ohio_req *q;
+  unsigned tail, idx;
+
+  q = &io->req[r];
+  tail = *io->sqTail;
+  idx = tail & *io->sqMask;
+  sqe = (struct io_uring_sqe *)io->sqes + idx;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = q->fd;
+  sqe->addr = (unsigned long)(q->buf+q->done);
+  sqe->len = q->len-q->done;
+  sqe->off = q->off+q->done;
+  sqe->user_data = r;
+  io->sqArray[idx] = idx;
+  __atomic_store_n(io->sqTail, tail+1, __ATOMIC_RELEASE);
+  io->queued++;
+}
+
+// Next completion, waiting for one if needed. Returns the request, or
+// -1 with *res = -errno if the ring fails
+static int uringReap(struct ohio *io, int *res) {
+  struct io_uring_cqe *cqe;
+  unsigned head;
+  int r;
+
+  while (1) {
+    head = *io->cqHead;
+    if (head != __atomic_load_n(io->cqTail, __ATOMIC_ACQUIRE))
+      break;
+    if (syscall(__NR_io_uring_enter, io->ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+        && errno != EINTR) {
+      *res = -errno;
+      return -1;
+    }
+  }
+  cqe = (struct io_uring_cqe *)io->cqes + (head & *io->cqMask);
+  *res = cqe->res;
+  r = (int)cqe->user_data;
+  __atomic_store_n(io->cqHead, head+1, __ATOMIC_RELEASE);
+  return r;
+}
+
+// Takes back the reads the kernel refused from the submission ring and
+// puts them, in order, in front of the fallback queue
+static void uringUnqueue(struct ohio *io) {
+  struct io_uring_sqe *sqe;
+  unsigned tail;
+  int r;
+
+  tail = *io->sqTail;
+  for (; io->queued > 0; io->queued--) {
+    --tail;
+    sqe = (struct io_uring_sqe *)io->sqes + (tail & *io->sqMask);
+    r = (int)sqe->user_data;
+    io->req[r].next = io->head;
+    io->head = r;
+    if (io->tail < 0) io->tail = r;
+  }
+  __atomic_store_n(io->sqTail, tail, __ATOMIC_RELEASE);
+}
+
+#endif
+
+
+int ohio_init(struct ohio *io, unsigned depth) {
+  unsigned i;
+
+  memset(io, 0, sizeof(*io));
+  io->ring = -1;
+  io->depth = depth > 0 ? depth : 1;
+  io->req = (struct ohio_req *)calloc(io->depth, sizeof(struct ohio_req));
+  if (io->req == NULL) return -1;
+  for (i = 0; i < io->depth; ++i)
+    io->req[i].next = i+1 < io->depth ? (int)i+1 : -1;
+  io->free = 0;
+  io->head = io->tail = -1;
+#ifdef HAVE_URING
+  if (getenv("OHIO_NO_URING") == NULL)
+    uringInit(io);
+#endif
+  return 0;
+}
+
+void ohio_exit(struct ohio *io) {
+#ifdef HAVE_URING
+  if (io->ring >= 0) {
+    munmap(io->sqes, io->sqesSize);
+    if (io->cqSize > 0) munmap(io->cqRing, io->cqSize);
+    munmap(io->sqRing, io->sqSize);
+    close(io->ring);
+  }
+#endif
+  free(io->req);
+  io->req = NULL;
+}
+
+int ohio_read(struct ohio *io, int fd, void *buf, unsigned len, long long off, void *tag) {
+  struct ohio_req *q;
+  int r;
+
+  if (io->free < 0) return -1;
+  r = io->free;
+  q = &io->req[r];
+  io->free = q->next;
+  q->fd = fd;
+  q->buf = (char *)buf;
+  q->len = len;
+  q->done = 0;
+  q->off = off;
+  q->tag = tag;
+  q->next = -1;
+  io->inflight++;
+#ifdef HAVE_URING
+  if (io->ring >= 0) {
+    uringPush(io, r);
+    return 0;
+  }
+#endif
+  if (io->tail >= 0) io->req[io->tail].next = r;
+  else io->head = r;
+  io->tail = r;
+  return 0;
+}
+
+int ohio_submit(struct ohio *io) {
+#ifdef HAVE_URING
+  int r;
+
+  while (io->ring >= 0 && io->queued > 0) {
+    r = syscall(__NR_io_uring_enter, io->ring, io->queued, 0, 0, NULL, 0);
+    if (r > 0) io->queued -= r;
+    else if (r < 0 && errno != EINTR) return -errno;
+  }
+#else
+  (void)io;
+#endif
+  return 0;
+}
+
+// Next read of the fallback queue, done with pread()
+static int preadNext(struct ohio *io, int *res) {
+  struct ohio_req *q;
+  ssize_t k;
+  int r;
+
+  r = io->head;
+  q = &io->req[r];
+  io->head = q->next;
+  if (io->head < 0) io->tail = -1;
+  *res = 0;
+  while (q->done < q->len) {
+    k = pread(q->fd, q->buf+q->done, q->len-q->done, q->off+q->done);
+    if (k < 0 && errno == EINTR) continue;
+    if (k < 0) *res = -errno;
+    if (k <= 0) break;
+    q->done += k;
+  }
+  if (*res == 0) *res = q->done;
+  return r;
+}
+
+#ifdef HAVE_URING
+static int uringNext(struct ohio *io, int *res) {
+  struct ohio_req *q;
+  int r;
+
+  while (1) {
+    // the reads refused by the kernel go through pread(), those it took
+    // stay in the ring
+    if (io->head >= 0) return preadNext(io, res);
+    if (ohio_submit(io) < 0) {
+      uringUnqueue(io);
+      continue;
+    }
+    r = uringReap(io, res);
+    if (r < 0) return -1;
+    q = &io->req[r];
+    if (*res == -EINTR || *res == -EAGAIN || (*res > 0 && q->done+*res < q->len)) {
+      // short read: ask for the rest
+      if (*res > 0) q->done += *res;
+      uringPush(io, r);
+      continue;
+    }
+    if (*res >= 0) *res = q->done+*res;
+    return r;
+  }
+}
+#endif
+
+int ohio_wait(struct ohio *io, void **tag) {
+  struct ohio_req *q;
+  int r, res;
+
+  *tag = NULL;
+  if (io->inflight == 0) return -1;
+#ifdef HAVE_URING
+  if (io->ring >= 0) r = uringNext(io, &res);
+  else
+#endif
+  r = preadNext(io, &res);
+  if (r < 0) return res;
+  q = &io->req[r];
+  *tag = q->tag;
+  q->next = io->free;
+  io->free = r;
+  io->inflight--;
+  return res;
+}
+
+int ohio_uring(struct ohio *io) {
+  return io->ring >= 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * ohash_io: batched reads through io_uring, with a pread() fallback.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Up to depth reads are queued with ohio_read(), handed to the kernel in
+ * one system call by ohio_submit(), and reaped one at a time, in any
+ * order, by ohio_wait(). Short reads are completed internally, so a read
+ * only ends early at the end of the file. When io_uring is not available
+ * (old kernel, seccomp) the reads are done with pread() in ohio_wait().
+ */
+
+#ifndef OHASH_IO_H
+#define OHASH_IO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ohio_req {
+  int fd;
+  char *buf;
+  unsigned len;
+  unsigned done;
+  long long off;
+  void *tag;
+  int next;             // free list, or fallback queue
+};
+
+struct ohio {
+  int ring;             // io_uring descriptor, -1 for the pread fallback
+  unsigned depth;
+  unsigned inflight;    // queued or submitted, not reaped
+  unsigned queued;      // queued, not submitted
+  struct ohio_req *req;
+  int free;             // first free request
+  int head, tail;       // fallback queue
+  // io_uring rings
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+  unsigned *cqHead, *cqTail, *cqMask;
+  void *sqes, *cqes;
+  void *sqRing, *cqRing;
+  unsigned long sqSize, cqSize, sqesSize;
+};
+
+// Returns 0, or -1 if out of memory. OHIO_NO_URING in the environment
+// forces the fallback
+int ohio_init(struct ohio *io, unsigned depth);
+void ohio_exit(struct ohio *io);
+// Queues a read of len bytes of fd at off into buf. Returns -1 when
+// depth reads are already in flight
+int ohio_read(struct ohio *io, int fd, void *buf, unsigned len, long long off, void *tag);
+// Hands the queued reads to the kernel. Returns 0, or -errno if it
+// refuses them: they stay queued and ohio_wait() reads them with pread()
+int ohio_submit(struct ohio *io);
+// Waits for a read to complete; sets *tag and returns the number of
+// bytes read or -errno. -1 with *tag NULL if nothing is in flight, and
+// -errno with *tag NULL if the ring fails
+int ohio_wait(struct ohio *io, void **tag);
+// 1 if reads go through io_uring
+int ohio_uring(struct ohio *io);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,295 @@
+/*
+ * Runtime selection of the SIMD variants used by the ohash kernels.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * The skip loop of a kernel is a chain of dependent table lookups and
+ * stays scalar. What can be vectorized is the verification of a window,
+ * the initialisation of the shift table and the search for the rare
+ * bytes of a pattern: each has a scalar, SSE4.2, AVX2 and AVX-512
+ * variant, and the best one supported by the CPU is chosen once, at
+ * startup, with cpuid.
+ *
+ * OHASH_ISA=scalar|sse4.2|avx2|avx512 forces a variant (for benchmarking)
+ * and OHASH_ISA_REPORT=1 prints the selected one on stderr.
+ */
+
+#ifndef OHASH_ISA_H
+#define OHASH_ISA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OHASH_X86
+#include <immintrin.h>
+#endif
+
+#define ISA_SCALAR 0
+#define ISA_SSE42 1
+#define ISA_AVX2 2
+#define ISA_AVX512 3
+#define ISA_COUNT 4
+
+struct isa_ops {
+  const char *name;
+  // 1 if x[0..len-1] == y[0..len-1], never reads past len
+  int (*verify)(unsigned char *x, unsigned char *y, int len);
+  // t[0..len-1] = v
+  void (*fill)(int *t, int v, int len);
+  // first s < len with y[s+o1] == c1 and y[s+o2] == c2, or len; never
+  // reads y[s+o] for s >= len
+  int (*pair)(unsigned char *y, int len, int o1, int c1, int o2, int c2);
+  int lanes;    // bytes tested at once by pair, for the cost model
+};
+
+
+static int verify_scalar(unsigned char *x, unsigned char *y, int len) {
+  int j;
+
+  j = 0;
+  while (j < len && x[j] == y[j]) j++;
+  return j >= len;
+}
+
+static void fill_scalar(int *t, int v, int len) {
+  int i;
+
+  for (i = 0; i < len; ++i)
+    t[i] = v;
+}
+
+// memchr() is vectorized by the C library
+static int pair_scalar(unsigned char *y, int len, int o1, int c1, int o2, int c2) {
+  unsigned char *r;
+  int s;
+
+  s = 0;
+  while (s < len) {
+    r = (unsigned char *)memchr(y+s+o1, c1, len-s);
+    if (r == NULL) break;
+    s = (int)(r-y)-o1;
+    if (y[s+o2] == c2) return s;
+    ++s;
+  }
+  return len;
+}
+
+#ifdef OHASH_X86
+
+// Windows shorter than a vector are checked by the scalar loop, longer
+// ones end with a vector overlapping the previous one
+__attribute__((target("sse4.2")))
+static int verify_sse42(unsigned char *x, unsigned char *y, int len) {
+  __m128i a, b;
+  int j;
+
+  if (len < 16)
+    return verify_scalar(x, y, len);
+  for (j = 0; j < len-16; j += 16) {
+    a = _mm_loadu_si128((__m128i *)(x+j));
+    b = _mm_loadu_si128((__m128i *)(y+j));
+    a = _mm_xor_si128(a, b);
+    if (!_mm_testz_si128(a, a)) return 0;
+  }
+  a = _mm_loadu_si128((__m128i *)(x+len-16));
+  b = _mm_loadu_si128((__m128i *)(y+len-16));
+  a = _mm_xor_si128(a, b);
+  return _mm_testz_si128(a, a);
+}
+
+__attribute__((target("sse4.2")))
+static void fill_sse42(int *t, int v, int len) {
+  __m128i w;
+  int i;
+
+  w = _mm_set1_epi32(v);
+  for (i = 0; i+4 <= len; i += 4)
+    _mm_storeu_si128((__m128i *)(t+i), w);
+  for (; i < len; ++i)
+    t[i] = v;
+}
+
+__attribute__((target("sse4.2")))
+static int pair_sse42(unsigned char *y, int len, int o1, int c1, int o2, int c2) {
+  __m128i a, b, v1, v2;
+  unsigned int k;
+  int s;
+
+  v1 = _mm_set1_epi8((char)c1);
+  v2 = _mm_set1_epi8((char)c2);
+  for (s = 0; s+16 <= len; s += 16) {
+    a = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(y+s+o1)), v1);
+    b = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(y+s+o2)), v2);
+    k = (unsigned int)_mm_movemask_epi8(_mm_and_si128(a, b));
+    if (k != 0) return s+__builtin_ctz(k);
+  }
+  return s+pair_scalar(y+s, len-s, o1, c1, o2, c2);
+}
+
+__attribute__((target("avx2")))
+static int verify_avx2(unsigned char *x, unsigned char *y, int len) {
+  __m256i a, b;
+  int j;
+
+  if (len < 32)
+    return verify_sse42(x, y, len);
+  for (j = 0; j < len-32; j += 32) {
+    a = _mm256_loadu_si256((__m256i *)(x+j));
+    b = _mm256_loadu_si256((__m256i *)(y+j));
+    a = _mm256_xor_si256(a, b);
+    if (!_mm256_testz_si256(a, a)) return 0;
+  }
+  a = _mm256_loadu_si256((__m256i *)(x+len-32));
+  b = _mm256_loadu_si256((__m256i *)(y+len-32));
+  a = _mm256_xor_si256(a, b);
+  return _mm256_testz_si256(a, a);
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(int *t, int v, int len) {
+  __m256i w;
+  int i;
+
+  w = _mm256_set1_epi32(v);
+  for (i = 0; i+8 <= len; i += 8)
+    _mm256_storeu_si256((__m256i *)(t+i), w);
+  for (; i < len; ++i)
+    t[i] = v;
+}
+
+__attribute__((target("avx2")))
+static int pair_avx2(unsigned char *y, int len, int o1, int c1, int o2, int c2) {
+  __m256i a, b, v1, v2;
+  unsigned int k;
+  int s;
+
+  v1 = _mm256_set1_epi8((char)c1);
+  v2 = _mm256_set1_epi8((char)c2);
+  for (s = 0; s+32 <= len; s += 32) {
+    a = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(y+s+o1)), v1);
+    b = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(y+s+o2)), v2);
+    k = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(a, b));
+    if (k != 0) return s+__builtin_ctz(k);
+  }
+  return s+pair_sse42(y+s, len-s, o1, c1, o2, c2);
+}
+
+// Masked loads do not fault past len, so the tail needs no special case
+__attribute__((target("avx512f,avx512bw")))
+static int verify_avx512(unsigned char *x, unsigned char *y, int len) {
+  __m512i a, b;
+  __mmask64 k;
+  int j;
+
+  for (j = 0; j < len; j += 64) {
+    k = len-j >= 64 ? ~0ULL : (1ULL<<(len-j))-1;
+    a = _mm512_maskz_loadu_epi8(k, x+j);
+    b = _mm512_maskz_loadu_epi8(k, y+j);
+    if (_mm512_cmpneq_epu8_mask(a, b)) return 0;
+  }
+  return 1;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int pair_avx512(unsigned char *y, int len, int o1, int c1, int o2, int c2) {
+  __m512i v1, v2;
+  __mmask64 k;
+  int s;
+
+  v1 = _mm512_set1_epi8((char)c1);
+  v2 = _mm512_set1_epi8((char)c2);
+  for (s = 0; s < len; s += 64) {
+    k = len-s >= 64 ? ~0ULL : (1ULL<<(len-s))-1;
+    k = _mm512_mask_cmpeq_epu8_mask(k, _mm512_maskz_loadu_epi8(k, y+s+o1), v1);
+    k = _mm512_mask_cmpeq_epu8_mask(k, _mm512_maskz_loadu_epi8(k, y+s+o2), v2);
+    if (k != 0) return s+__builtin_ctzll(k);
+  }
+  return len;
+}
+
+__attribute__((target("avx512f")))
+static void fill_avx512(int *t, int v, int len) {
+  __m512i w;
+  int i;
+
+  w = _mm512_set1_epi32(v);
+  for (i = 0; i+16 <= len; i += 16)
+    _mm512_storeu_si512((void *)(t+i), w);
+  for (; i < len; ++i)
+    t[i] = v;
+}
+
+#endif
+
+static struct isa_ops isa_table[ISA_COUNT] = {
+  { "scalar", verify_scalar, fill_scalar, pair_scalar, 16 },
+#ifdef OHASH_X86
+  { "sse4.2", verify_sse42, fill_sse42, pair_sse42, 16 },
+  { "avx2", verify_avx2, fill_avx2, pair_avx2, 32 },
+  { "avx512", verify_avx512, fill_avx512, pair_avx512, 64 },
+#endif
+};
+
+// Best variant supported by the CPU
+static int isa_detect(void) {
+#ifdef OHASH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    return ISA_AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return ISA_AVX2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return ISA_SSE42;
+#endif
+  return ISA_SCALAR;
+}
+
+static struct isa_ops *isa = &isa_table[ISA_SCALAR];
+
+// Name of the selected variant
+static const char *isa_name(void) {
+  return isa->name;
+}
+
+// Resolved once before main(); a forced variant the CPU does not
+// support is refused and the detected one is kept
+__attribute__((constructor))
+static void isa_init(void) {
+  int best, i;
+  char *s;
+
+  best = isa_detect();
+  i = best;
+  s = getenv("OHASH_ISA");
+  if (s != NULL) {
+    for (i = 0; i < ISA_COUNT; ++i)
+      if (isa_table[i].name != NULL && strcmp(s, isa_table[i].name) == 0)
+        break;
+    if (i > best) {
+      fprintf(stderr, "ohash: ISA '%s' not available, using %s\n", s, isa_table[best].name);
+      i = best;
+    }
+  }
+  isa = &isa_table[i];
+  s = getenv("OHASH_ISA_REPORT");
+  if (s != NULL && *s != '0')
+    fprintf(stderr, "ohash: using %s kernels\n", isa_name());
+}
+
+#define VERIFY(x, y, len) (isa->verify((x), (y), (len)))
+#define FILL(t, v, len) (isa->fill((t), (v), (len)))
+#define PAIR(y, len, o1, c1, o2, c2) (isa->pair((y), (len), (o1), (c1), (o2), (c2)))
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * ohash_par: NUMA-aware parallel search of a text in memory.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef OHASH_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+#include "ohash_par.h"
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+// Pages moved per move_pages() call
+#define BATCH 1024
+
+struct worker {
+  struct ohash_par *par;
+  ohash_pattern *p;
+  unsigned char *y;
+  size_t n, from, to;       // windows starting in y[from..to-1]
+  int t;
+  int started;
+  long long count;
+  double seconds;
+};
+
+struct place {
+  int rank;                 // CPUs of the same node before this one
+  int node;
+  int cpu;
+};
+
+static int nodeOf(int cpu) {
+#ifdef OHASH_NUMA
+  int node;
+
+  if (numa_available() >= 0) {
+    node = numa_node_of_cpu(cpu);
+    if (node >= 0 && node < OHASH_MAX_NODES) return node;
+  }
+#else
+  (void)cpu;
+#endif
+  return 0;
+}
+
+// First CPU of each node, then the second one of each node...
+static int byRank(const void *a, const void *b) {
+  const struct place *u = (const struct place *)a, *v = (const struct place *)b;
+
+  if (u->rank != v->rank) return u->rank-v->rank;
+  if (u->node != v->node) return u->node-v->node;
+  return u->cpu-v->cpu;
+}
+
+int ohash_par_init(struct ohash_par *par, int threads) {
+  struct place *cpus;
+  int seen[OHASH_MAX_NODES];
+  cpu_set_t set;
+  int c, k, t;
+
+  memset(par, 0, sizeof(*par));
+  par->threads = threads > 0 ? threads : 1;
+  par->cpu = (int *)malloc(par->threads*sizeof(int));
+  par->node = (int *)malloc(par->threads*sizeof(int));
+  cpus = (struct place *)malloc(CPU_SETSIZE*sizeof(struct place));
+  if (par->cpu == NULL || par->node == NULL || cpus == NULL) {
+    free(cpus);
+    ohash_par_exit(par);
+    return -1;
+  }
+  memset(seen, 0, sizeof(seen));
+  k = 0;
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (c = 0; c < CPU_SETSIZE; ++c)
+      if (CPU_ISSET(c, &set)) {
+        cpus[k].cpu = c;
+        cpus[k].node = nodeOf(c);
+        cpus[k].rank = seen[cpus[k].node]++;
+        ++k;
+      }
+  }
+  if (k == 0) {
+    // not pinned
+    cpus[0].cpu = -1;
+    cpus[0].node = 0;
+    k = 1;
+  }
+  qsort(cpus, k, sizeof(struct place), byRank);
+  par->nodes = 1;
+  for (t = 0; t < par->threads; ++t) {
+    par->cpu[t] = cpus[t%k].cpu;
+    par->node[t] = cpus[t%k].node;
+    if (par->node[t] >= par->nodes) par->nodes = par->node[t]+1;
+  }
+  free(cpus);
+  return 0;
+}
+
+void ohash_par_exit(struct ohash_par *par) {
+  free(par->cpu);
+  free(par->node);
+  par->cpu = par->node = NULL;
+}
+
+// Chunk boundaries are page-aligned in memory, so that no page is shared
+// by two workers
+static size_t start(struct ohash_par *par, unsigned char *y, size_t n, int t) {
+  uintptr_t page, at;
+
+  if (t == 0) return 0;
+  if (t == par->threads) return n;
+  page = sysconf(_SC_PAGESIZE);
+  at = ((uintptr_t)y + n/par->threads*t + page-1) & ~(page-1);
+  return MIN(at-(uintptr_t)y, n);
+}
+
+long long ohash_par_place(struct ohash_par *par, unsigned char *y, size_t n) {
+#ifdef OHASH_NUMA
+  void *pages[BATCH];
+  int nodes[BATCH], status[BATCH];
+  uintptr_t page, at, end;
+  long long failed;
+  int t, k, i;
+
+  if (numa_available() < 0) return -1;
+  page = sysconf(_SC_PAGESIZE);
+  failed = 0;
+  for (t = 0; t < par->threads; ++t) {
+    at = ((uintptr_t)y + start(par, y, n, t)) & ~(page-1);
+    end = (uintptr_t)y + start(par, y, n, t+1);
+    while (at < end) {
+      for (k = 0; k < BATCH && at < end; ++k, at += page) {
+        pages[k] = (void *)at;
+        nodes[k] = par->node[t];
+      }
+      if (move_pages(0, k, pages, nodes, status, MPOL_MF_MOVE) < 0) {
+        failed += k;
+        continue;
+      }
+      for (i = 0; i < k; ++i)
+        if (status[i] < 0) ++failed;
+    }
+  }
+  return failed;
+#else
+  (void)par;
+  (void)y;
+  (void)n;
+  return -1;
+#endif
+}
+
+static void *work(void *arg) {
+  struct worker *w = (struct worker *)arg;
+  struct timespec t0, t1;
+  ohash_pattern *p;
+  cpu_set_t set;
+  int cpu;
+
+  cpu = w->par->cpu[w->t];
+  if (cpu >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+  // the tables of the clone are allocated and filled from this CPU
+  p = ohash_clone(w->p);
+  if (p == NULL) {
+    w->count = -1;
+    return NULL;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  w->count = ohash_scan(p, w->y+w->from, MIN(w->to+p->m-1, w->n)-w->from, NULL, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  w->seconds = (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)*1e-9;
+  ohash_free(p);
+  return NULL;
+}
+
+long long ohash_par_count(struct ohash_par *par, ohash_pattern *p, unsigned char *y, size_t n) {
+  struct ohash_node_stat *s;
+  struct worker *w;
+  pthread_t *tid;
+  long long count;
+  int t;
+
+  w = (struct worker *)calloc(par->threads, sizeof(struct worker));
+  tid = (pthread_t *)malloc(par->threads*sizeof(pthread_t));
+  if (w == NULL || tid == NULL) {
+    free(w);
+    free(tid);
+    return -1;
+  }
+  for (t = 0; t < par->threads; ++t) {
+    w[t].par = par;
+    w[t].p = p;
+    w[t].y = y;
+    w[t].n = n;
+    w[t].from = start(par, y, n, t);
+    w[t].to = start(par, y, n, t+1);
+    w[t].t = t;
+    if (pthread_create(&tid[t], NULL, work, &w[t]) == 0) w[t].started = 1;
+    else w[t].count = -1;
+  }
+  memset(par->stat, 0, sizeof(par->stat));
+  count = 0;
+  for (t = 0; t < par->threads; ++t) {
+    if (w[t].started) pthread_join(tid[t], NULL);
+    if (w[t].count < 0 || count < 0) count = -1;
+    else count += w[t].count;
+    s = &par->stat[par->node[t]];
+    s->threads++;
+    s->bytes += w[t].to-w[t].from;
+    if (w[t].seconds > s->seconds) s->seconds = w[t].seconds;
+  }
+  free(w);
+  free(tid);
+  return count;
+}
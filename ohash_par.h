@@ -0,0 +1,64 @@
+/*
+ * ohash_par: NUMA-aware parallel search of a text in memory.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * The text is split into one page-aligned chunk per worker. Workers are
+ * pinned to CPUs taken in turn from each node, and each one scans its
+ * chunk with a clone of the pattern, whose shift table is then on its
+ * node. ohash_par_place() moves the pages of each chunk to the node of
+ * its worker, once for a text searched many times. Nodes are known with
+ * -DOHASH_NUMA (-lnuma); otherwise all CPUs count as node 0 and nothing
+ * is moved.
+ */
+
+#ifndef OHASH_PAR_H
+#define OHASH_PAR_H
+
+#include "ohash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OHASH_MAX_NODES 64
+
+struct ohash_node_stat {
+  int threads;
+  long long bytes;          // scanned by the workers of the node
+  double seconds;           // longest worker of the node
+};
+
+struct ohash_par {
+  int threads;
+  int nodes;
+  int *cpu;                 // CPU of each worker
+  int *node;                // node of each worker
+  struct ohash_node_stat stat[OHASH_MAX_NODES];  // last search
+};
+
+// Returns 0, or -1 if out of memory
+int ohash_par_init(struct ohash_par *par, int threads);
+void ohash_par_exit(struct ohash_par *par);
+// Moves the chunks of y[0..n-1] to the nodes of their workers. Returns
+// the number of pages that could not be moved, -1 without NUMA support
+long long ohash_par_place(struct ohash_par *par, unsigned char *y, size_t n);
+// Number of occurrences of p in y[0..n-1], which is never written, -1
+// if out of memory or threads
+long long ohash_par_count(struct ohash_par *par, ohash_pattern *p, unsigned char *y, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
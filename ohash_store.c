@@ -0,0 +1,223 @@
+/*
+ * ohash_store: compiled patterns saved to a file and mapped back.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ohash_store.h"
+
+#define MAGIC "OHASHPAT"
+#define ORDER 0x01020304
+#define LINE 64
+#define ALIGNED(len) (((len)+LINE-1) & ~(uint64_t)(LINE-1))
+#define BITS_SIZE (65536/8)
+#define SLOT_SIZE (65536*2)
+
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t order;
+  uint32_t count;
+  uint32_t unused;
+  uint64_t size;
+  char pad[32];
+};
+
+struct record {
+  int32_t m, strategy, kernel, q, b, sh0, sh1, vlen, tsize, width;
+  int32_t two3;
+  int32_t probes, probe[OHASH_PROBES];
+  int32_t rare, o1, o2, look;
+  unsigned char rank[256];
+};
+
+// Offsets of the pieces of a record, from its start
+struct layout {
+  uint64_t x, shift, bits, slot, end;
+};
+
+static void layoutOf(struct layout *l, int m, int tsize, int width, int two3) {
+  l->x = ALIGNED(sizeof(struct record));
+  l->shift = l->x + ALIGNED((uint64_t)m);
+  l->bits = l->shift + ALIGNED((uint64_t)tsize*width);
+  l->slot = l->bits + (two3 ? ALIGNED(BITS_SIZE) : 0);
+  l->end = l->slot + (two3 ? ALIGNED(SLOT_SIZE) : 0);
+}
+
+// Writes len bytes then zeros up to the next line
+static int put(FILE *f, const void *buf, uint64_t len) {
+  static const char zero[LINE];
+
+  if (len > 0 && fwrite(buf, 1, len, f) != len) return -1;
+  len = ALIGNED(len)-len;
+  if (len > 0 && fwrite(zero, 1, len, f) != len) return -1;
+  return 0;
+}
+
+int ohash_save(const char *path, ohash_pattern **p, int count) {
+  struct header h;
+  struct record r;
+  struct layout l;
+  uint64_t *offset, at;
+  FILE *f;
+  int i, two3, e;
+
+  offset = (uint64_t *)malloc((count > 0 ? count : 1)*sizeof(uint64_t));
+  if (offset == NULL) return -1;
+  at = sizeof(struct header) + ALIGNED((uint64_t)count*sizeof(uint64_t));
+  for (i = 0; i < count; ++i) {
+    offset[i] = at;
+    layoutOf(&l, p[i]->m, p[i]->tsize, p[i]->width, p[i]->bits != NULL);
+    at += l.end;
+  }
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, 8);
+  h.version = OHASH_STORE_VERSION;
+  h.order = ORDER;
+  h.count = count;
+  h.size = at;
+
+  f = fopen(path, "wb");
+  if (f == NULL) {
+    free(offset);
+    return -1;
+  }
+  if (put(f, &h, sizeof(h)) < 0 || put(f, offset, (uint64_t)count*sizeof(uint64_t)) < 0)
+    goto fail;
+  for (i = 0; i < count; ++i) {
+    two3 = p[i]->bits != NULL;
+    memset(&r, 0, sizeof(r));
+    r.m = p[i]->m;
+    r.strategy = p[i]->strategy;
+    r.kernel = p[i]->kernel;
+    r.q = p[i]->q;
+    r.b = p[i]->b;
+    r.sh0 = p[i]->sh0;
+    r.sh1 = p[i]->sh1;
+    r.vlen = p[i]->vlen;
+    r.tsize = p[i]->tsize;
+    r.width = p[i]->width;
+    r.two3 = two3;
+    r.probes = p[i]->probes;
+    memcpy(r.probe, p[i]->probe, sizeof(r.probe));
+    r.rare = p[i]->rare;
+    r.o1 = p[i]->o1;
+    r.o2 = p[i]->o2;
+    r.look = p[i]->look;
+    memcpy(r.rank, p[i]->rank, 256);
+    if (put(f, &r, sizeof(r)) < 0 || put(f, p[i]->x, p[i]->m) < 0
+        || put(f, p[i]->shift, (uint64_t)p[i]->tsize*p[i]->width) < 0)
+      goto fail;
+    if (two3 && (put(f, p[i]->bits, BITS_SIZE) < 0 || put(f, p[i]->slot, SLOT_SIZE) < 0))
+      goto fail;
+  }
+  free(offset);
+  if (fclose(f) != 0) return -1;
+  return 0;
+
+fail:
+  e = errno;
+  free(offset);
+  fclose(f);
+  errno = e;
+  return -1;
+}
+
+int ohash_load(ohash_set *set, const char *path) {
+  const struct header *h;
+  const struct record *r;
+  const uint64_t *offset;
+  unsigned char *base;
+  struct layout l;
+  struct stat st;
+  ohash_pattern *p;
+  int fd, i;
+
+  memset(set, 0, sizeof(*set));
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct header)) {
+    close(fd);
+    return -1;
+  }
+  base = (unsigned char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return -1;
+  set->map = base;
+  set->size = st.st_size;
+
+  h = (const struct header *)base;
+  if (memcmp(h->magic, MAGIC, 8) != 0 || h->version != OHASH_STORE_VERSION || h->order != ORDER
+      || h->size != (uint64_t)st.st_size
+      || sizeof(struct header) + (uint64_t)h->count*sizeof(uint64_t) > h->size)
+    goto fail;
+  set->count = h->count;
+  set->pattern = (ohash_pattern *)calloc(h->count > 0 ? h->count : 1, sizeof(ohash_pattern));
+  if (set->pattern == NULL) goto fail;
+  offset = (const uint64_t *)(base+sizeof(struct header));
+  for (i = 0; i < set->count; ++i) {
+    if (offset[i]%LINE != 0 || offset[i] > h->size-sizeof(struct record)) goto fail;
+    r = (const struct record *)(base+offset[i]);
+    if (r->m < 1 || r->tsize < 0 || r->width < 0 || r->width > 2) goto fail;
+    layoutOf(&l, r->m, r->tsize, r->width, r->two3);
+    if (l.end > h->size-offset[i]) goto fail;
+    p = &set->pattern[i];
+    p->m = r->m;
+    p->strategy = r->strategy;
+    p->kernel = r->kernel;
+    p->q = r->q;
+    p->b = r->b;
+    p->sh0 = r->sh0;
+    p->sh1 = r->sh1;
+    p->vlen = r->vlen;
+    p->tsize = r->tsize;
+    p->width = r->width;
+    p->probes = r->probes;
+    memcpy(p->probe, r->probe, sizeof(r->probe));
+    p->rare = r->rare;
+    p->o1 = r->o1;
+    p->o2 = r->o2;
+    p->look = r->look;
+    memcpy(p->rank, r->rank, 256);
+    // the kernels only read the tables
+    p->x = base+offset[i]+l.x;
+    if (r->tsize > 0) p->shift = base+offset[i]+l.shift;
+    if (r->two3) {
+      p->bits = (unsigned int *)(base+offset[i]+l.bits);
+      p->slot = (unsigned short *)(base+offset[i]+l.slot);
+    }
+    p->inplace = 1;
+    if (ohash_bind(p) < 0) goto fail;
+  }
+  return 0;
+
+fail:
+  ohash_unload(set);
+  errno = EINVAL;
+  return -1;
+}
+
+void ohash_unload(ohash_set *set) {
+  if (set->map != NULL) munmap(set->map, set->size);
+  free(set->pattern);
+  memset(set, 0, sizeof(*set));
+}
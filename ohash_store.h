@@ -0,0 +1,59 @@
+/*
+ * ohash_store: compiled patterns saved to a file and mapped back.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * File layout, in the byte order of the machine that wrote it, each
+ * piece starting on a 64-byte boundary:
+ *   header     "OHASHPAT", version, byte order mark, count, file size
+ *   directory  count 64-bit offsets of the records
+ *   record     m, strategy, kernel, q, b, sh0, sh1, vlen, tsize, width,
+ *              two3, probes, probe[4], rare, o1, o2, look, rank[256]
+ *   x          the m bytes of the pattern
+ *   shift      tsize entries of width bytes, none for the rare-byte engine
+ *   two3       when set, the TWO3 bigram bitmap (8 KB) then the row of
+ *              each bigram (65536 16-bit entries)
+ * A loaded pattern points into the mapping: nothing is rebuilt, and its
+ * tables are shared by the processes mapping the file.
+ */
+
+#ifndef OHASH_STORE_H
+#define OHASH_STORE_H
+
+#include "ohash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OHASH_STORE_VERSION 5
+
+typedef struct ohash_set {
+  void *map;
+  size_t size;
+  int count;
+  ohash_pattern *pattern;   // count patterns, in the order saved
+} ohash_set;
+
+// Writes the count patterns of p to path. Returns 0, or -1 with errno set
+int ohash_save(const char *path, ohash_pattern **p, int count);
+// Maps path. Returns 0, or -1 if it cannot be read, is not a pattern
+// file of this version and byte order, or fails ohash_bind()
+int ohash_load(ohash_set *set, const char *path);
+void ohash_unload(ohash_set *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,514 @@
+/*
+ * ohash_test: differential test of the ohash library against memcmp().
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Patterns are cut from texts over alphabets of 2 to 256 symbols, runs
+ * and tandem repeats, altered or not, and compiled with every strategy,
+ * with and without the lookahead. Each compiled pattern must find the
+ * occurrences found by a naive memcmp() matcher with:
+ *   - ohash_exec() on a copy of the text padded for the sentinel;
+ *   - ohash_scan() on a read-only mapping that ends at an inaccessible
+ *     page;
+ *   - ohash_some(), ohash_first() and ohash_last() on ranges of it;
+ *   - a cursor, including with a budget of 0;
+ *   - a copy made by ohash_clone();
+ *   - a copy compiled with ohash_compile_in();
+ *   - the patterns saved by ohash_save() and mapped by ohash_load();
+ *   - the same patterns compiled by ohash_compile_bulk();
+ *   - ohash_column() and ohash_column64(), against a search of each row.
+ * Every kernel must be used at least once.
+ * ohash_bind() must refuse tampered shifts.
+ * ohash_select() must name the strategy of an OHASH_AUTO compile.
+ * ohash_unz.c must read gzip members whose magic straddles its input
+ * buffer and report truncated ones.
+ *
+ * usage: ohash_test [seed]
+ * Prints the failures and their number; the exit status is 1 if any.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include "ohash.h"
+#include "ohash_store.h"
+#include "ohash_bulk.h"
+#include "ohash_column.h"
+#include "ohash_cursor.h"
+#include "ohash_unz.h"
+
+#define TEXT (64<<10)
+#define PATTERNS 48
+#define MAXM 2100
+#define RANGES 8
+#define STRATEGIES 10
+#define SELECTS 2000
+#define ROWS 3000
+
+static int failures, checks;
+static long long occ[TEXT];
+static int nocc;
+
+#define CHECK(cond, ...) \
+  do { \
+    ++checks; \
+    if (!(cond)) { \
+      ++failures; \
+      if (failures <= 20) { \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+      } \
+    } \
+  } while (0)
+
+// Occurrences of x[0..m-1] in y[0..n-1] into occ
+static void naive(const unsigned char *x, int m, const unsigned char *y, long n) {
+  long i;
+
+  nocc = 0;
+  for (i = 0; i+m <= n; ++i)
+    if (memcmp(x, y+i, m) == 0) occ[nocc++] = i;
+}
+
+// Occurrences lying in [from, to): the first one, the last one and their
+// number
+static long long inRange(int m, long from, long to, long long *first, long long *last) {
+  long long count;
+  int k;
+
+  count = 0;
+  *first = *last = -1;
+  for (k = 0; k < nocc; ++k)
+    if (occ[k] >= from && occ[k]+m <= to) {
+      if (count++ == 0) *first = occ[k];
+      *last = occ[k];
+    }
+  return count;
+}
+
+// n bytes of y copied to a read-only mapping that ends at a page which
+// cannot be accessed, so that reading or writing past y faults
+static unsigned char *readOnly(const unsigned char *y, long n, void **map, size_t *size) {
+  unsigned char *r;
+  long page;
+  size_t len;
+
+  page = sysconf(_SC_PAGESIZE);
+  len = (n+page-1)/page*page;
+  *size = len+page;
+  *map = mmap(NULL, *size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (*map == MAP_FAILED) {
+    perror("mmap");
+    exit(2);
+  }
+  r = (unsigned char *)*map + len-n;
+  memcpy(r, y, n);
+  mprotect(*map, len, PROT_READ);
+  mprotect((unsigned char *)*map+len, page, PROT_NONE);
+  return r;
+}
+
+static void makeText(unsigned char *y, long n, int kind) {
+  long i;
+
+  for (i = 0; i < n; ++i)
+    switch (kind) {
+      case 0 : y[i] = "ab"[rand()%2]; break;
+      case 1 : y[i] = "acgt"[rand()%4]; break;
+      case 2 : y[i] = 'a'+rand()%26; break;
+      case 3 : y[i] = rand()%256; break;
+      // runs of one byte
+      case 4 : y[i] = i%5000 < 4000 ? 'a' : "ab"[rand()%2]; break;
+      // tandem repeats of a random motif
+      default : y[i] = i < 97 ? "abcdx"[rand()%5] : y[i-97];
+    }
+}
+
+static long long onStep(void *ctx, long long pos) {
+  (void)ctx;
+  return pos+1;
+}
+
+// All the searches of p against the naive occurrences of its bytes
+static void checkPattern(ohash_pattern *p, const char *what, unsigned char *y, long n,
+                         unsigned char *ro, unsigned char *pad) {
+  ohash_cursor c;
+  long long first, last, count, some[4];
+  long from, to;
+  char name[40];
+  int r, k;
+
+  ohash_kernel_name(p, name, sizeof(name));
+  memcpy(pad, y, n);
+  CHECK(ohash_exec(p, pad, n) == nocc, "%s %s m=%d: exec %lld, want %d",
+        what, name, p->m, ohash_exec(p, pad, n), nocc);
+  CHECK(ohash_scan(p, ro, n, NULL, NULL) == nocc, "%s %s m=%d: scan %lld, want %d",
+        what, name, p->m, ohash_scan(p, ro, n, NULL, NULL), nocc);
+  for (r = 0; r < RANGES; ++r) {
+    from = rand()%n;
+    to = from+rand()%(n-from+1);
+    if (r == 0) {
+      from = 0;
+      to = n;
+    }
+    count = inRange(p->m, from, to, &first, &last);
+    CHECK(ohash_first(p, ro, from, to) == first, "%s %s m=%d: first in [%ld, %ld)",
+          what, name, p->m, from, to);
+    CHECK(ohash_last(p, ro, from, to) == last, "%s %s m=%d: last in [%ld, %ld)",
+          what, name, p->m, from, to);
+    k = (int)ohash_some(p, ro, from, to, some, 4);
+    CHECK(k == (count < 4 ? count : 4) && (k == 0 || some[0] == first),
+          "%s %s m=%d: some in [%ld, %ld)", what, name, p->m, from, to);
+  }
+  ohash_cursor_init(&c, p, ro, n);
+  while (ohash_cursor_step(&c, rand()%3 == 0 ? 0 : rand()%5000, onStep, NULL));
+  CHECK(c.count == nocc, "%s %s m=%d: cursor %lld, want %d", what, name, p->m, c.count, nocc);
+}
+
+// ohash_bind() must refuse shifts that would move the window too far
+static void checkBind(ohash_pattern *p) {
+  ohash_pattern t;
+
+  t = *p;
+  CHECK(ohash_bind(&t) == 0, "bind refuses a compiled pattern m=%d", p->m);
+  t = *p;
+  t.sh0 = 0x7ffffffe;
+  CHECK(ohash_bind(&t) < 0, "bind accepts sh0 = 0x7ffffffe");
+  t = *p;
+  t.sh1 = t.sh0+1;
+  CHECK(ohash_bind(&t) < 0, "bind accepts sh1 > sh0");
+  t = *p;
+  t.vlen = t.m-1;
+  if (t.vlen != p->vlen) CHECK(ohash_bind(&t) < 0, "bind accepts a wrong vlen");
+  if (!p->rare) {
+    t = *p;
+    t.width = 3-t.width;
+    CHECK(ohash_bind(&t) < 0, "bind accepts a wrong width");
+  }
+}
+
+// ohash_select() names the strategy of OHASH_AUTO, OHASH_RARE when the
+// compiled pattern uses the rare-byte engine
+static void checkSelect(unsigned char *x, int m) {
+  ohash_pattern *p;
+  int s;
+
+  p = ohash_compile(x, m, OHASH_AUTO);
+  if (p == NULL) return;
+  s = ohash_select(x, m);
+  CHECK(s == (p->rare ? OHASH_RARE : p->strategy), "select m=%d: %d, compiled %d%s",
+        m, s, p->strategy, p->rare ? " rare" : "");
+  ohash_free(p);
+}
+
+// The patterns of a text compiled at once, as ohash_compile() would
+static void testBulk(unsigned char **xs, int *ms, int count, int strategy,
+                     unsigned char *y, long n) {
+  ohash_bulk b;
+  ohash_pattern *p, t;
+  char want[40], got[40];
+  int i;
+
+  CHECK(ohash_compile_bulk(&b, xs, ms, count, strategy, 4) == 0 && b.count == count,
+        "bulk compile of %d patterns", count);
+  if (b.pattern == NULL) return;
+  for (i = 0; i < count; ++i) {
+    p = ohash_compile(xs[i], ms[i], strategy);
+    if (p == NULL) {
+      CHECK(b.pattern[i] == NULL, "bulk: pattern %d m=%d compiled", i, ms[i]);
+      continue;
+    }
+    CHECK(b.pattern[i] != NULL, "bulk: pattern %d m=%d missing", i, ms[i]);
+    if (b.pattern[i] == NULL) {
+      ohash_free(p);
+      continue;
+    }
+    ohash_kernel_name(p, want, sizeof(want));
+    ohash_kernel_name(b.pattern[i], got, sizeof(got));
+    CHECK(strcmp(want, got) == 0, "bulk: pattern %d m=%d kernel %s, want %s",
+          i, ms[i], got, want);
+    CHECK(ohash_scan(b.pattern[i], y, n, NULL, NULL) == ohash_scan(p, y, n, NULL, NULL),
+          "bulk: pattern %d m=%d count", i, ms[i]);
+    t = *b.pattern[i];
+    CHECK(ohash_bind(&t) == 0, "bulk: bind refuses pattern %d m=%d", i, ms[i]);
+    ohash_free(p);
+  }
+  ohash_bulk_free(&b);
+}
+
+static void testText(int kind, unsigned char *y, unsigned char *pad, int *kernels,
+                     int *looks, int *rares) {
+  static const int strategies[STRATEGIES] = {
+    OHASH_AUTO, OHASH_1, OHASH_2, OHASH_3, OHASH_RARE,
+    OHASH_AUTO|OHASH_LOOK, OHASH_1|OHASH_LOOK, OHASH_2|OHASH_LOOK, OHASH_3|OHASH_LOOK,
+    OHASH_RARE|OHASH_LOOK
+  };
+  static ohash_pattern *saved[PATTERNS*STRATEGIES];
+  static unsigned char xs[PATTERNS+1][MAXM];
+  unsigned char *xp[PATTERNS+1];
+  int ms[PATTERNS+1];
+  unsigned char x[MAXM], *ro;
+  ohash_pattern *p, *q;
+  ohash_set set;
+  char path[] = "/tmp/ohash_testXXXXXX";
+  void *map;
+  size_t size;
+  void *ws;
+  size_t need;
+  long n;
+  int t, s, m, nsaved, fd, i;
+
+  n = TEXT;
+  makeText(y, n, kind);
+  ro = readOnly(y, n, &map, &size);
+  nsaved = 0;
+  for (t = 0; t < PATTERNS; ++t) {
+    m = t%6 == 5 ? 300+rand()%(MAXM-300) : 1+rand()%(t%2 ? 12 : 64);
+    memcpy(x, y+rand()%(n-m), m);
+    // a third of the patterns have no occurrence in most texts
+    if (t%3 == 2) x[rand()%m] ^= 1+rand()%255;
+    memcpy(xs[t], x, m);
+    xp[t] = xs[t];
+    ms[t] = m;
+    naive(x, m, y, n);
+    for (s = 0; s < STRATEGIES; ++s) {
+      p = ohash_compile(x, m, strategies[s]);
+      CHECK(p != NULL, "compile m=%d strategy %d", m, strategies[s]);
+      if (p == NULL) continue;
+      if (p->rare) rares[0]++;
+      else {
+        kernels[p->kernel]++;
+        if (p->look) looks[0]++;
+      }
+      checkPattern(p, "compile", y, n, ro, pad);
+      checkBind(p);
+
+      need = ohash_workspace_size(m);
+      ws = malloc(need);
+      q = ohash_compile_in(ws, need, x, m, strategies[s]);
+      CHECK(q != NULL && ohash_pattern_size(q) <= need, "compile_in m=%d", m);
+      if (q != NULL) checkPattern(q, "compile_in", y, n, ro, pad);
+      free(ws);
+
+      q = ohash_clone(p);
+      CHECK(q != NULL, "clone m=%d", m);
+      if (q != NULL) {
+        checkPattern(q, "clone", y, n, ro, pad);
+        ohash_free(q);
+      }
+      saved[nsaved++] = p;
+    }
+  }
+  for (t = 0; t < SELECTS; ++t) {
+    m = 2+rand()%79;
+    memcpy(x, y+rand()%(n-m), m);
+    if (t%3 == 2) x[rand()%m] ^= 1+rand()%255;
+    checkSelect(x, m);
+  }
+  CHECK(ohash_select(x, 0) == -1, "select m=0");
+
+  // an empty pattern is not compiled
+  xp[PATTERNS] = xs[PATTERNS];
+  ms[PATTERNS] = 0;
+  testBulk(xp, ms, PATTERNS+1, OHASH_AUTO, ro, n);
+  testBulk(xp, ms, PATTERNS+1, OHASH_3|OHASH_LOOK, ro, n);
+
+  // save and load round trip
+  fd = mkstemp(path);
+  CHECK(fd >= 0, "mkstemp");
+  if (fd >= 0) {
+    close(fd);
+    CHECK(ohash_save(path, saved, nsaved) == 0, "save");
+    CHECK(ohash_load(&set, path) == 0 && set.count == nsaved, "load");
+    for (i = 0; i < set.count; ++i) {
+      naive(saved[i]->x, saved[i]->m, y, n);
+      CHECK(set.pattern[i].kernel == saved[i]->kernel && set.pattern[i].rare == saved[i]->rare,
+            "load: pattern %d changed", i);
+      CHECK(ohash_scan(&set.pattern[i], ro, n, NULL, NULL) == nocc, "load: pattern %d m=%d",
+            i, saved[i]->m);
+    }
+    ohash_unload(&set);
+    unlink(path);
+  }
+  for (i = 0; i < nsaved; ++i)
+    ohash_free(saved[i]);
+  munmap(map, size);
+}
+
+// Rows of 0 to 20 bytes over {a, b} found with ohash_column() and
+// ohash_column64(), from the first row and from a slice, against
+// the occurrences of each row
+static void testColumn(unsigned char *y) {
+  static int32_t o32[ROWS+1];
+  static int64_t o64[ROWS+1], counts[ROWS], want[ROWS];
+  static unsigned char bitmap[(ROWS+7)/8];
+  unsigned char x[8];
+  ohash_pattern *p;
+  long long r, rows, selected, got;
+  int first, t, m, mode, k, ok;
+
+  makeText(y, TEXT, 0);
+  o32[0] = 0;
+  for (r = 0; r < ROWS; ++r)
+    o32[r+1] = o32[r] + (r%7 == 3 ? 0 : rand()%21);
+  for (r = 0; r <= ROWS; ++r)
+    o64[r] = o32[r];
+  for (t = 0; t < 24; ++t) {
+    m = 1+rand()%8;
+    // half of the patterns straddle the end of a row
+    r = rand()%(ROWS-1);
+    k = o32[r+1]-m/2;
+    if (t%2 == 0 || k < 0) k = rand()%(o32[ROWS]-m);
+    memcpy(x, y+k, m);
+    p = ohash_compile(x, m, t%4 < 2 ? OHASH_AUTO : OHASH_2);
+    if (p == NULL) continue;
+    // a slice of the column starts at a non-zero offset
+    first = t%3 == 0 ? 0 : 1+rand()%(ROWS/2);
+    rows = t%5 == 4 ? 0 : ROWS-first-rand()%100;
+    selected = 0;
+    for (r = 0; r < rows; ++r) {
+      naive(x, m, y+o32[first+r], o32[first+r+1]-o32[first+r]);
+      want[r] = nocc;
+      if (nocc > 0) selected++;
+    }
+    // bitmap only, counts only, both
+    for (mode = 0; mode < 3; ++mode) {
+      memset(counts, 0xff, sizeof(counts));
+      memset(bitmap, 0xff, sizeof(bitmap));
+      if (t%2 == 0)
+        got = ohash_column(p, o32+first, y, rows, mode != 1 ? bitmap : NULL,
+                           mode != 0 ? counts : NULL);
+      else
+        got = ohash_column64(p, o64+first, y, rows, mode != 1 ? bitmap : NULL,
+                             mode != 0 ? counts : NULL);
+      ok = got == selected;
+      for (r = 0; r < rows; ++r) {
+        if (mode != 1) ok &= ((bitmap[r>>3]>>(r&7))&1) == (want[r] > 0);
+        if (mode != 0) ok &= counts[r] == want[r];
+      }
+      CHECK(ok, "column%s m=%d rows %d+%lld mode %d: %lld rows, want %lld",
+            t%2 ? "64" : "", m, first, rows, mode, got, selected);
+    }
+    ohash_free(p);
+  }
+}
+
+// One gzip member of y[0..n-1] with a comment of len bytes in its header
+static long gzMember(unsigned char *out, long cap, const unsigned char *y, long n, int len) {
+  static char comment[OHUNZ_IN];
+  gz_header h;
+  z_stream s;
+  long r;
+
+  memset(&s, 0, sizeof(s));
+  memset(&h, 0, sizeof(h));
+  memset(comment, 'c', len);
+  comment[len] = '\0';
+  h.comment = (Bytef *)comment;
+  if (deflateInit2(&s, 6, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return -1;
+  deflateSetHeader(&s, &h);
+  s.next_in = (Bytef *)y;
+  s.avail_in = n;
+  s.next_out = out;
+  s.avail_out = cap;
+  r = deflate(&s, Z_FINISH) == Z_STREAM_END ? (long)(cap-s.avail_out) : -1;
+  deflateEnd(&s);
+  return r;
+}
+
+// Decompresses the len bytes of z through a file with ohash_unz.c.
+// Returns the length read, -1 on an error
+static long unzip(const unsigned char *z, long len, unsigned char *out, long cap) {
+  struct ohunz u;
+  char path[] = "/tmp/ohash_testXXXXXX";
+  long got, k;
+  int fd;
+
+  fd = mkstemp(path);
+  if (fd < 0 || write(fd, z, len) != len) return -1;
+  lseek(fd, 0, SEEK_SET);
+  unlink(path);
+  got = -1;
+  if (ohunz_open(&u, fd) == OHUNZ_GZIP) {
+    got = 0;
+    while ((k = ohunz_read(&u, out+got, cap-got < 4096 ? cap-got : 4096)) > 0)
+      got += k;
+    if (k < 0) got = -1;
+  }
+  ohunz_close(&u);
+  close(fd);
+  return got;
+}
+
+// A second member starting just before, across and just after the end of
+// the input buffer of ohash_unz.c
+static void testUnz(void) {
+  static unsigned char a[100000], b[1000], z[2*OHUNZ_IN], out[200000];
+  long la, lb, at, got;
+  int shift, pad;
+
+  makeText(a, sizeof(a), 3);
+  makeText(b, sizeof(b), 2);
+  la = gzMember(z, sizeof(z), a, sizeof(a), 0);
+  for (shift = -2; shift <= 1; ++shift) {
+    pad = OHUNZ_IN+shift-la;
+    at = gzMember(z, sizeof(z), a, sizeof(a), pad);
+    CHECK(at == OHUNZ_IN+shift, "gzip member of %ld bytes, want %d", at, OHUNZ_IN+shift);
+    lb = gzMember(z+at, sizeof(z)-at, b, sizeof(b), 0);
+    got = unzip(z, at+lb, out, sizeof(out));
+    CHECK(got == (long)(sizeof(a)+sizeof(b)) && memcmp(out, a, sizeof(a)) == 0
+          && memcmp(out+sizeof(a), b, sizeof(b)) == 0,
+          "gzip: second member at %ld, read %ld bytes", at, got);
+    got = unzip(z, at+lb/2, out, sizeof(out));
+    CHECK(got < 0, "gzip: truncated second member not reported");
+  }
+}
+
+int main(int argc, char **argv) {
+  static unsigned char y[TEXT], pad[TEXT+MAXM];
+  static const char *names[OHASH_K_COUNT] = {
+    "byte", "shl1", "shl8", "rank", "two3", "hash3", "hash8", "wide"
+  };
+  unsigned char run[16];
+  ohash_pattern *p;
+  int kernels[OHASH_K_COUNT], looks, rares, kind, k;
+
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  memset(kernels, 0, sizeof(kernels));
+  looks = rares = 0;
+  for (kind = 0; kind < 6; ++kind)
+    testText(kind, y, pad, kernels, &looks, &rares);
+
+  // no q-gram of a run is free of collisions
+  memset(run, 'a', sizeof(run));
+  p = ohash_compile(run, sizeof(run), OHASH_1);
+  if (p != NULL) {
+    kernels[p->kernel]++;
+    naive(run, sizeof(run), y, TEXT);
+    memcpy(pad, y, TEXT);
+    CHECK(ohash_exec(p, pad, TEXT) == nocc, "run of 16 bytes");
+    ohash_free(p);
+  }
+  for (k = 0; k < OHASH_K_COUNT; ++k)
+    CHECK(kernels[k] > 0, "kernel %s never used", names[k]);
+  CHECK(looks > 0 && rares > 0, "lookahead used %d times, rare-byte engine %d times",
+        looks, rares);
+  testColumn(y);
+  testUnz();
+
+  printf("ohash_test: %d checks, %d failures (isa %s)\n", checks, failures, ohash_isa());
+  return failures > 0;
+}
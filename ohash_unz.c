@@ -0,0 +1,202 @@
+/*
+ * ohash_unz: streaming decompression of gzip streams and LZ4 frames.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef OHASH_LZ4
+#include <lz4frame.h>
+#endif
+#include "ohash_unz.h"
+
+// Reads more input once the buffer is used up. Returns the bytes available
+static unsigned fill(struct ohunz *z) {
+  ssize_t k;
+
+  if (z->inPos < z->inLen || z->eof) return z->inLen-z->inPos;
+  z->inPos = z->inLen = 0;
+  do k = read(z->fd, z->in, OHUNZ_IN);
+  while (k < 0 && errno == EINTR);
+  if (k <= 0) z->eof = 1;
+  else z->inLen = k;
+  return z->inLen;
+}
+
+// 1 if the next input bytes start with magic
+static int starts(struct ohunz *z, const unsigned char *magic, unsigned len) {
+  ssize_t k;
+
+  fill(z);
+  // a magic across the end of the buffer: the bytes left go to the front
+  // and the rest of the buffer is refilled
+  if (z->inLen-z->inPos < len && !z->eof) {
+    memmove(z->in, z->in+z->inPos, z->inLen-z->inPos);
+    z->inLen -= z->inPos;
+    z->inPos = 0;
+    while (z->inLen < len && !z->eof) {
+      do k = read(z->fd, z->in+z->inLen, OHUNZ_IN-z->inLen);
+      while (k < 0 && errno == EINTR);
+      if (k <= 0) z->eof = 1;
+      else z->inLen += k;
+    }
+  }
+  return z->inLen-z->inPos >= len && memcmp(z->in+z->inPos, magic, len) == 0;
+}
+
+static const unsigned char gzMagic[] = {0x1f, 0x8b};
+static const unsigned char lz4Magic[] = {0x04, 0x22, 0x4d, 0x18};
+
+static long gzRead(struct ohunz *z, unsigned char *buf, long len) {
+  z_stream *s = (z_stream *)z->state;
+  unsigned avail;
+  long out;
+  int r;
+
+  out = 0;
+  while (out < len) {
+    if (z->ended) {
+      // go on if another member follows
+      if (!starts(z, gzMagic, 2)) break;
+      inflateReset(s);
+      z->ended = 0;
+    }
+    // with no input left, inflate() may still have output to flush
+    avail = fill(z);
+    s->next_in = z->in+z->inPos;
+    s->avail_in = avail;
+    s->next_out = buf+out;
+    s->avail_out = len-out > 1<<30 ? 1<<30 : len-out;
+    r = inflate(s, Z_NO_FLUSH);
+    z->inPos = z->inLen-s->avail_in;
+    out = s->next_out-buf;
+    if (r == Z_STREAM_END) z->ended = 1;
+    else if (r == Z_BUF_ERROR && avail == 0) return -1;  // truncated
+    else if (r != Z_OK && r != Z_BUF_ERROR) return -1;
+  }
+  return out;
+}
+
+#ifdef OHASH_LZ4
+static long lz4Read(struct ohunz *z, unsigned char *buf, long len) {
+  LZ4F_dctx *d = (LZ4F_dctx *)z->state;
+  size_t in, dst, r;
+  long out;
+
+  out = 0;
+  while (out < len) {
+    if (z->ended) {
+      // go on if another frame follows
+      if (!starts(z, lz4Magic, 4)) break;
+      z->ended = 0;
+    }
+    // with no input left, the context may still have output to flush
+    in = fill(z);
+    dst = len-out;
+    r = LZ4F_decompress(d, buf+out, &dst, z->in+z->inPos, &in, NULL);
+    if (LZ4F_isError(r)) return -1;
+    z->inPos += in;
+    out += dst;
+    if (r == 0) z->ended = 1;
+    else if (in == 0 && dst == 0) return -1;  // truncated
+  }
+  return out;
+}
+#endif
+
+int ohunz_open(struct ohunz *z, int fd) {
+  z_stream *s;
+
+  memset(z, 0, sizeof(*z));
+  z->fd = fd;
+  z->in = (unsigned char *)malloc(OHUNZ_IN);
+  if (z->in == NULL) return -1;
+  if (starts(z, gzMagic, 2)) {
+    s = (z_stream *)calloc(1, sizeof(z_stream));
+    // 15+16: gzip wrapper only
+    if (s == NULL || inflateInit2(s, 15+16) != Z_OK) {
+      free(s);
+      return -1;
+    }
+    z->state = s;
+    z->format = OHUNZ_GZIP;
+  }
+  else if (starts(z, lz4Magic, 4)) {
+#ifdef OHASH_LZ4
+    LZ4F_dctx *d;
+
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&d, LZ4F_VERSION)))
+      return -1;
+    z->state = d;
+    z->format = OHUNZ_LZ4;
+#else
+    return -1;
+#endif
+  }
+  else {
+    z->format = OHUNZ_RAW;
+  }
+  return z->format;
+}
+
+long ohunz_read(struct ohunz *z, unsigned char *buf, long len) {
+  long out;
+
+  switch (z->format) {
+    case OHUNZ_GZIP :
+      return gzRead(z, buf, len);
+#ifdef OHASH_LZ4
+    case OHUNZ_LZ4 :
+      return lz4Read(z, buf, len);
+#endif
+    default :
+      // what fill() already read comes first
+      out = 0;
+      while (out < len && fill(z) > 0) {
+        if (len-out < z->inLen-z->inPos) {
+          memcpy(buf+out, z->in+z->inPos, len-out);
+          z->inPos += len-out;
+          out = len;
+        }
+        else {
+          memcpy(buf+out, z->in+z->inPos, z->inLen-z->inPos);
+          out += z->inLen-z->inPos;
+          z->inPos = z->inLen;
+        }
+      }
+      return out;
+  }
+}
+
+void ohunz_close(struct ohunz *z) {
+  if (z->state != NULL) {
+    if (z->format == OHUNZ_GZIP) {
+      inflateEnd((z_stream *)z->state);
+      free(z->state);
+    }
+#ifdef OHASH_LZ4
+    else LZ4F_freeDecompressionContext((LZ4F_dctx *)z->state);
+#endif
+  }
+  free(z->in);
+  z->in = NULL;
+  z->state = NULL;
+}
+
+const char *ohunz_name(int format) {
+  return format == OHUNZ_GZIP ? "gzip" : format == OHUNZ_LZ4 ? "lz4" : "raw";
+}
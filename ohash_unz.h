@@ -0,0 +1,57 @@
+/*
+ * ohash_unz: streaming decompression of gzip streams and LZ4 frames.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * The format is told from the first bytes of the file; anything else is
+ * passed through. Concatenated gzip members and LZ4 frames are read one
+ * after the other. gzip needs zlib (-lz); LZ4 is compiled in with
+ * -DOHASH_LZ4 (-llz4).
+ */
+
+#ifndef OHASH_UNZ_H
+#define OHASH_UNZ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OHUNZ_RAW 0
+#define OHUNZ_GZIP 1
+#define OHUNZ_LZ4 2
+
+#define OHUNZ_IN (256<<10)
+
+struct ohunz {
+  int fd;
+  int format;
+  unsigned char *in;    // compressed input
+  unsigned inPos, inLen;
+  int eof;              // nothing left to read from fd
+  int ended;            // at the end of a gzip member or LZ4 frame
+  void *state;          // z_stream or LZ4F context
+};
+
+// Reads the magic bytes of fd. Returns the format, or -1 if it is not
+// compiled in or out of memory
+int ohunz_open(struct ohunz *z, int fd);
+// Up to len decompressed bytes into buf; 0 at the end, -1 on error
+long ohunz_read(struct ohunz *z, unsigned char *buf, long len);
+void ohunz_close(struct ohunz *z);
+const char *ohunz_name(int format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,466 @@
+/*
+ * ohashd: a local search daemon over corpora kept in shared memory.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Each corpus named on the command line is read once into the POSIX
+ * shared memory object /ohashd.<name>, which other processes may map
+ * read-only and search with the library themselves. Queries come over a
+ * Unix domain socket, one per line, the pattern being the rest of the
+ * line:
+ *
+ *   count <corpus> <pattern>    number of occurrences
+ *   exists <corpus> <pattern>   1 if the pattern occurs, 0 otherwise
+ *   stats                       queries served and pattern cache
+ *
+ * Each query is answered by one line, "<result> <microseconds>" with the
+ * time from the reading of the query to its answer, or "error <reason>".
+ *
+ * Patterns are compiled through ohash_cache.c. Each corpus has a worker
+ * that searches it block by block for all of its pending queries at
+ * once, so that a block is read from memory once for the batch and
+ * stays in cache while the patterns are run on it. A query arriving
+ * during a pass joins it at the next block and leaves once it has seen
+ * every block, wrapping around the end of the corpus.
+ *
+ * The shared memory objects are created by the daemon or not at all: a
+ * name already in use, e.g. by another daemon, is an error. The socket
+ * replaces one left by a daemon that is gone, and nothing else.
+ *
+ * usage: ohashd [-s socket] [-m mode] [-C megabytes] name=file...
+ *   -s  path of the socket (default /tmp/ohashd.sock)
+ *   -m  permissions of the shared memory objects, in octal (default 0600)
+ *   -C  memory bound of the pattern cache (default 64 MiB)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ohash.h"
+#include "ohash_cache.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Bytes searched for all the queries of a batch before the next block
+#define BLOCK (1<<20)
+#define CORPORA 64
+#define SHARDS 16
+
+#define OP_COUNT 0
+#define OP_EXISTS 1
+
+struct query {
+  ohash_pattern *p;
+  int op;
+  long long result;
+  long long left;           // blocks still to search
+  int done;
+  struct query *next;
+};
+
+struct corpus {
+  char name[64];
+  char shm[80];             // name of the shared memory object
+  unsigned char *text;
+  size_t size;
+  long long blocks;
+  long long served;
+  pthread_mutex_t lock;
+  pthread_cond_t work;      // queries pending
+  pthread_cond_t done;      // queries answered
+  struct query *pending;    // to join the pass at the next block
+};
+
+static struct corpus corpora[CORPORA];
+static int ncorpora;
+static ohash_cache *cache;
+static volatile sig_atomic_t quit;
+static mode_t shmMode = 0600;
+
+
+static long long now(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+// Reads path into a new shared memory object, left read-only
+static int load(struct corpus *c, const char *name, const char *path) {
+  struct stat st;
+  size_t len;
+  ssize_t k;
+  int fd, shm;
+
+  if (strlen(name) >= sizeof(c->name) || strchr(name, '/') != NULL) {
+    fprintf(stderr, "ohashd: bad corpus name %s\n", name);
+    return -1;
+  }
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  strcpy(c->name, name);
+  snprintf(c->shm, sizeof(c->shm), "/ohashd.%s", name);
+  c->size = st.st_size;
+  len = MAX(c->size, 1);
+  shm = shm_open(c->shm, O_CREAT|O_EXCL|O_RDWR, shmMode);
+  if (shm < 0) {
+    if (errno == EEXIST) fprintf(stderr, "ohashd: %s is already in use\n", c->shm);
+    else perror(c->shm);
+    close(fd);
+    return -1;
+  }
+  // the mode is masked by umask at creation
+  if (fchmod(shm, shmMode) < 0 || ftruncate(shm, len) < 0) {
+    perror(c->shm);
+    goto fail;
+  }
+  c->text = (unsigned char *)mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, shm, 0);
+  if (c->text == MAP_FAILED) {
+    perror(c->shm);
+    goto fail;
+  }
+  for (len = 0; len < c->size; len += k) {
+    k = read(fd, c->text+len, c->size-len);
+    if (k < 0 && errno == EINTR) k = 0;
+    else if (k <= 0) {
+      perror(path);
+      munmap(c->text, MAX(c->size, 1));
+      goto fail;
+    }
+  }
+  mprotect(c->text, MAX(c->size, 1), PROT_READ);
+  close(shm);
+  close(fd);
+  c->blocks = MAX((long long)((c->size+BLOCK-1)/BLOCK), 1);
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->work, NULL);
+  pthread_cond_init(&c->done, NULL);
+  return 0;
+
+fail:
+  close(shm);
+  shm_unlink(c->shm);
+  close(fd);
+  return -1;
+}
+
+// Makes room for the socket at path: 0 if there is nothing there or a
+// socket no daemon listens on any more, which is removed
+static int clear(const char *path, struct sockaddr_un *addr) {
+  struct stat st;
+  int fd, live;
+
+  if (lstat(path, &st) < 0) {
+    if (errno == ENOENT) return 0;
+    perror(path);
+    return -1;
+  }
+  if (!S_ISSOCK(st.st_mode)) {
+    fprintf(stderr, "ohashd: %s exists and is not a socket\n", path);
+    return -1;
+  }
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  live = connect(fd, (struct sockaddr *)addr, sizeof(*addr)) == 0;
+  close(fd);
+  if (live) {
+    fprintf(stderr, "ohashd: a daemon already listens on %s\n", path);
+    return -1;
+  }
+  if (unlink(path) < 0) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+// One pass after the other over the blocks of the corpus, for the
+// queries taken so far
+static void *worker(void *arg) {
+  struct corpus *c = (struct corpus *)arg;
+  struct query *active, *q, **link;
+  size_t lo, stop;
+  long long b;
+  int answered;
+
+  active = NULL;
+  b = 0;
+  while (1) {
+    pthread_mutex_lock(&c->lock);
+    while (active == NULL && c->pending == NULL)
+      pthread_cond_wait(&c->work, &c->lock);
+    while (c->pending != NULL) {
+      q = c->pending;
+      c->pending = q->next;
+      q->left = c->blocks;
+      q->next = active;
+      active = q;
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    // windows starting in the block, which end at most m-1 bytes after it
+    lo = (size_t)b*BLOCK;
+    for (q = active; q != NULL; q = q->next) {
+      stop = MIN(lo+BLOCK+q->p->m-1, c->size);
+      if (q->op == OP_COUNT)
+        q->result += ohash_scan(q->p, c->text+lo, stop-lo, NULL, NULL);
+      else if (ohash_first(q->p, c->text, lo, stop) >= 0) {
+        q->result = 1;
+        q->left = 1;
+      }
+      q->left--;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    answered = 0;
+    for (link = &active; *link != NULL; ) {
+      q = *link;
+      if (q->left > 0) {
+        link = &q->next;
+        continue;
+      }
+      *link = q->next;
+      q->done = 1;
+      c->served++;
+      answered = 1;
+    }
+    if (answered) pthread_cond_broadcast(&c->done);
+    pthread_mutex_unlock(&c->lock);
+    b = (b+1)%c->blocks;
+  }
+  return NULL;
+}
+
+static void stats(FILE *out) {
+  struct ohash_cache_stats s;
+  long long served;
+  int i;
+
+  served = 0;
+  for (i = 0; i < ncorpora; ++i) {
+    pthread_mutex_lock(&corpora[i].lock);
+    served += corpora[i].served;
+    pthread_mutex_unlock(&corpora[i].lock);
+  }
+  ohash_cache_stats(cache, &s);
+  fprintf(out, "corpora %d queries %lld hits %lld misses %lld patterns %lld bytes %lld\n",
+          ncorpora, served, s.hits, s.misses, s.entries, s.bytes);
+}
+
+// Answers the query line[0..len-1], read at start
+static void answer(char *line, size_t len, FILE *out, long long start) {
+  struct corpus *c;
+  struct query q;
+  char *name, *x, *e;
+  int i;
+
+  e = line+len;
+  if (strcmp(line, "stats") == 0) {
+    stats(out);
+    return;
+  }
+  if (len > 6 && memcmp(line, "count ", 6) == 0) {
+    q.op = OP_COUNT;
+    name = line+6;
+  }
+  else if (len > 7 && memcmp(line, "exists ", 7) == 0) {
+    q.op = OP_EXISTS;
+    name = line+7;
+  }
+  else {
+    fprintf(out, "error unknown query\n");
+    return;
+  }
+  x = (char *)memchr(name, ' ', e-name);
+  if (x == NULL || x+1 == e) {
+    fprintf(out, "error no pattern\n");
+    return;
+  }
+  *x++ = '\0';
+  c = NULL;
+  for (i = 0; i < ncorpora; ++i)
+    if (strcmp(corpora[i].name, name) == 0) c = &corpora[i];
+  if (c == NULL) {
+    fprintf(out, "error unknown corpus\n");
+    return;
+  }
+  q.p = ohash_cache_get(cache, (unsigned char *)x, (int)(e-x), OHASH_AUTO);
+  if (q.p == NULL) {
+    fprintf(out, "error out of memory\n");
+    return;
+  }
+  q.result = 0;
+  q.done = 0;
+  pthread_mutex_lock(&c->lock);
+  q.next = c->pending;
+  c->pending = &q;
+  pthread_cond_signal(&c->work);
+  while (!q.done)
+    pthread_cond_wait(&c->done, &c->lock);
+  pthread_mutex_unlock(&c->lock);
+  ohash_cache_put(cache, q.p);
+  fprintf(out, "%lld %lld\n", q.result, (now()-start)/1000);
+}
+
+// A client, one query after the other
+static void *serve(void *arg) {
+  FILE *in, *out;
+  char *line;
+  size_t cap;
+  ssize_t len;
+  long long start;
+  int fd;
+
+  fd = (int)(long)arg;
+  in = fdopen(fd, "r");
+  out = fdopen(dup(fd), "w");
+  if (in == NULL || out == NULL) {
+    if (in != NULL) fclose(in);
+    else close(fd);
+    if (out != NULL) fclose(out);
+    return NULL;
+  }
+  line = NULL;
+  cap = 0;
+  while ((len = getline(&line, &cap, in)) > 0) {
+    start = now();
+    if (line[len-1] == '\n') line[--len] = '\0';
+    answer(line, len, out, start);
+    if (fflush(out) != 0) break;
+  }
+  free(line);
+  fclose(in);
+  fclose(out);
+  return NULL;
+}
+
+static void stop(int sig) {
+  (void)sig;
+  quit = 1;
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: ohashd [-s socket] [-m mode] [-C megabytes] name=file...\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  struct sockaddr_un addr;
+  struct sigaction sa;
+  pthread_attr_t attr;
+  pthread_t tid;
+  const char *path;
+  char *eq, *end;
+  long mb, mode;
+  int c, i, fd, s;
+
+  path = "/tmp/ohashd.sock";
+  mb = 64;
+  while ((c = getopt(argc, argv, "s:m:C:")) != -1) {
+    switch (c) {
+      case 's' :
+        path = optarg;
+        break;
+      case 'm' :
+        mode = strtol(optarg, &end, 8);
+        if (*optarg == '\0' || *end != '\0' || mode < 0 || mode > 0777) usage();
+        shmMode = (mode_t)mode;
+        break;
+      case 'C' :
+        mb = atol(optarg);
+        if (mb < 1) usage();
+        break;
+      default :
+        usage();
+    }
+  }
+  if (optind == argc || argc-optind > CORPORA) usage();
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "ohashd: socket path too long\n");
+    return 2;
+  }
+  cache = ohash_cache_new((size_t)mb<<20, SHARDS);
+  if (cache == NULL) {
+    fprintf(stderr, "ohashd: out of memory\n");
+    return 2;
+  }
+
+  for (i = optind; i < argc; ++i) {
+    eq = strchr(argv[i], '=');
+    if (eq == NULL) usage();
+    *eq = '\0';
+    if (load(&corpora[ncorpora], argv[i], eq+1) < 0) goto fail;
+    ncorpora++;
+  }
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (i = 0; i < ncorpora; ++i)
+    if (pthread_create(&tid, &attr, worker, &corpora[i]) != 0) {
+      fprintf(stderr, "ohashd: cannot start a worker\n");
+      goto fail;
+    }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (clear(path, &addr) < 0) goto fail;
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+    perror(path);
+    goto fail;
+  }
+  // no SA_RESTART, so that accept() returns on a signal
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  while (!quit) {
+    s = accept(fd, NULL, NULL);
+    if (s < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      perror("accept");
+      break;
+    }
+    if (pthread_create(&tid, &attr, serve, (void *)(long)s) != 0) close(s);
+  }
+  close(fd);
+  unlink(path);
+  for (i = 0; i < ncorpora; ++i)
+    shm_unlink(corpora[i].shm);
+  return 0;
+
+fail:
+  for (i = 0; i < ncorpora; ++i)
+    shm_unlink(corpora[i].shm);
+  return 2;
+}
@@ -0,0 +1,823 @@
+/*
+ * ohgrep: searches files for a fixed string with the ohash library.
+ * Copyright (C) 2012  Simone Faro and Thierry Lecroq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Files are mapped read-only and searched in place with ohash_scan(),
+ * which needs no sentinel after the text, so nothing is copied.
+ *
+ * With -r, directories are walked and the files are searched by a pool
+ * of workers. Files up to POOL_BUF bytes are read with batched io_uring
+ * submissions (see ohash_io.c) into pooled buffers padded for the
+ * sentinel, larger ones are mapped by the worker. Results are printed
+ * file by file, in the order of the walk.
+ *
+ * With -s, counts and offsets are computed without mapping the files:
+ * blocks are read ahead through ohash_io, with O_DIRECT where the file
+ * system allows it, and block k is searched while the next ones are
+ * being read. The last m-1 bytes of each block are carried over to the
+ * next one.
+ *
+ * With -z, gzip and LZ4 files are decompressed block by block in memory
+ * by a second thread, while the previous block is searched; offsets are
+ * in the decompressed text.
+ *
+ * Without -r, -c counts large mappings with -j workers pinned across the
+ * NUMA nodes, each one with its own copy of the shift table (see
+ * ohash_par.c); -N prints the throughput of each node.
+ *
+ * usage: ohgrep [-c [-N] | -b] [-r] [-j threads] [-s | -z] [-Q depth]
+ *               [-S strategy] [-K] pattern file...
+ *   (default) print each line containing the pattern once
+ *   -c        print the number of occurrences
+ *   -b        print the byte offset of each occurrence
+ *   -r        search the directories recursively
+ *   -j        number of workers (default: one per CPU)
+ *   -N        print the throughput of each NUMA node with -c
+ *   -s        stream the files block by block (with -c or -b)
+ *   -z        decompress gzip and LZ4 files (with -c or -b)
+ *   -Q        reads in flight (default 64)
+ *   -S 1..4   force a strategy instead of the per-pattern choice
+ *             (4: rare-byte engine)
+ *   -K        print the kernel and SIMD variant used on stderr
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ohash.h"
+#include "ohash_io.h"
+#include "ohash_unz.h"
+#include "ohash_par.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define MODE_LINES 0
+#define MODE_COUNT 1
+#define MODE_OFFSETS 2
+
+// Files up to this size are read into pooled buffers with -r
+#define POOL_BUF (1<<20)
+
+// -s: blocks read ahead, aligned for O_DIRECT
+#define BLOCK (4<<20)
+#define ALIGN 4096
+
+// -z: decompressed blocks
+#define ZBUFS 3
+
+// Mappings counted by all the workers (see ohash_par.c)
+#define PAR_MIN (64<<20)
+
+struct grep {
+  FILE *out;
+  const char *name;     // printed before each result, NULL for one file
+  unsigned char *text;  // the mapping
+  long long size;
+  long long base;       // offset of the block being scanned
+  long long done;       // end of the last line printed
+  int mode;
+  int stream;           // -s
+  int unzip;            // -z
+  int depth;            // blocks in flight with -s
+  struct ohash_par *par;  // -c on one file at a time
+  int nodes;            // -N
+};
+
+
+// Prints the line of the occurrence and goes on at the next line
+static long long onLine(void *ctx, long long pos) {
+  struct grep *g = (struct grep *)ctx;
+  unsigned char *s, *e;
+  long long at;
+
+  at = g->base+pos;
+  if (at < g->done)
+    return g->done-g->base;
+  s = g->text+at;
+  while (s > g->text && s[-1] != '\n') --s;
+  e = (unsigned char *)memchr(g->text+at, '\n', g->size-at);
+  if (e == NULL) e = g->text+g->size;
+  if (g->name != NULL) fprintf(g->out, "%s:", g->name);
+  fwrite(s, 1, e-s, g->out);
+  putc('\n', g->out);
+  g->done = e-g->text+1;
+  return g->done-g->base;
+}
+
+static long long onOffset(void *ctx, long long pos) {
+  struct grep *g = (struct grep *)ctx;
+
+  if (g->name != NULL) fprintf(g->out, "%s:", g->name);
+  fprintf(g->out, "%lld\n", g->base+pos);
+  return pos+1;
+}
+
+static long long searchText(ohash_pattern *p, struct grep *g) {
+  ohash_report report;
+
+  report = g->mode == MODE_LINES ? onLine : g->mode == MODE_OFFSETS ? onOffset : NULL;
+  g->base = 0;
+  g->done = 0;
+  return ohash_scan(p, g->text, g->size, report, g);
+}
+
+static void printCount(struct grep *g, long long count) {
+  if (g->mode != MODE_COUNT) return;
+  if (g->name != NULL) fprintf(g->out, "%s:", g->name);
+  fprintf(g->out, "%lld\n", count);
+}
+
+// Throughput of each NUMA node in the last parallel count
+static void printNodes(struct grep *g) {
+  struct ohash_node_stat *s;
+  int k;
+
+  for (k = 0; k < g->par->nodes; ++k) {
+    s = &g->par->stat[k];
+    if (s->threads == 0) continue;
+    fprintf(stderr, "ohgrep: %s: node %d, %d threads, %.1f MB/s\n", g->name != NULL ? g->name : "-",
+            k, s->threads, s->seconds > 0 ? s->bytes/s->seconds/1e6 : 0.0);
+  }
+}
+
+// Returns the number of occurrences, -1 on error
+static long long searchFile(ohash_pattern *p, const char *name, struct grep *g) {
+  struct stat st;
+  long long count;
+  void *text;
+  int fd;
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(name);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  count = 0;
+  if (st.st_size > 0) {
+    text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text == MAP_FAILED) {
+      perror(name);
+      close(fd);
+      return -1;
+    }
+#ifdef MADV_HUGEPAGE
+    // only honoured where the page cache can use huge pages
+    madvise(text, st.st_size, MADV_HUGEPAGE);
+#endif
+    madvise(text, st.st_size, MADV_SEQUENTIAL);
+    g->text = (unsigned char *)text;
+    g->size = st.st_size;
+    if (g->mode == MODE_COUNT && g->par != NULL && g->size >= PAR_MIN) {
+      count = ohash_par_count(g->par, p, g->text, g->size);
+      if (g->nodes) printNodes(g);
+    }
+    else {
+      count = searchText(p, g);
+    }
+    munmap(text, st.st_size);
+  }
+  close(fd);
+  printCount(g, count);
+  return count;
+}
+
+// Searches the block of len bytes at offset at of the file, preceded by
+// the last *c bytes of the previous one, which are saved in carry. There
+// must be room for *c bytes before block and m bytes after it
+static long long searchBlock(ohash_pattern *p, struct grep *g, unsigned char *block, long len,
+                             long long at, unsigned char *carry, int *c) {
+  unsigned char *w;
+  long long count;
+
+  w = block-*c;
+  memcpy(w, carry, *c);
+  len += *c;
+  g->base = at-*c;
+  count = 0;
+  if (len >= p->m) {
+    if (g->mode == MODE_COUNT)
+      count = ohash_exec(p, w, len);
+    else
+      count = ohash_scan(p, w, len, onOffset, g);
+  }
+  *c = MIN(p->m-1, len);
+  memmove(carry, w+len-*c, *c);
+  return count;
+}
+
+// Returns the number of occurrences, -1 on error. Block k is read into
+// buf[k%depth]+pad, the carry-over is copied just before it, and m bytes
+// are left after it for the sentinel of ohash_exec()
+static long long searchStream(ohash_pattern *p, const char *name, struct grep *g) {
+  struct ohio io;
+  struct stat st;
+  unsigned char **buf, *carry;
+  long long count, next, cur, nblocks, off, len;
+  int fd, dfd, depth, pad, c, k, res, *got;
+  void *tag;
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(name);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  dfd = -1;
+#ifdef O_DIRECT
+  // the last block, unless it is full, is read through fd
+  dfd = open(name, O_RDONLY|O_DIRECT);
+#endif
+  depth = g->depth;
+  nblocks = (st.st_size+BLOCK-1)/BLOCK;
+  if (depth > nblocks) depth = nblocks > 0 ? nblocks : 1;
+  pad = (p->m-1+ALIGN-1)/ALIGN*ALIGN;
+  count = -1;
+  carry = NULL;
+  got = NULL;
+  buf = (unsigned char **)calloc(depth, sizeof(unsigned char *));
+  if (buf == NULL || ohio_init(&io, depth) < 0) {
+    free(buf);
+    fprintf(stderr, "ohgrep: out of memory\n");
+    goto close;
+  }
+  got = (int *)calloc(depth, sizeof(int));
+  carry = (unsigned char *)malloc(p->m);
+  for (k = 0; k < depth; ++k)
+    if (posix_memalign((void **)&buf[k], ALIGN, pad+BLOCK+p->m) != 0) {
+      buf[k] = NULL;
+      break;
+    }
+  if (got == NULL || carry == NULL || k < depth) {
+    fprintf(stderr, "ohgrep: out of memory\n");
+    goto end;
+  }
+
+  count = 0;
+  next = cur = 0;
+  c = 0;
+  g->done = 0;
+  while (cur < nblocks) {
+    // keep depth blocks in flight
+    while (next < nblocks && next < cur+depth) {
+      off = next*BLOCK;
+      len = MIN(BLOCK, st.st_size-off);
+      k = next%depth;
+      got[k] = -1;
+      ohio_read(&io, dfd >= 0 && len == BLOCK ? dfd : fd, buf[k]+pad, len, off, (void *)(long)k);
+      ++next;
+    }
+    ohio_submit(&io);
+    k = cur%depth;
+    while (got[k] < 0) {
+      res = ohio_wait(&io, &tag);
+      if (res < 0) {
+        fprintf(stderr, "%s: %s\n", name, strerror(-res));
+        while (io.inflight > 0 && tag != NULL) ohio_wait(&io, &tag);
+        count = -1;
+        goto end;
+      }
+      got[(long)tag] = res;
+    }
+
+    count += searchBlock(p, g, buf[k]+pad, got[k], cur*BLOCK, carry, &c);
+    ++cur;
+  }
+
+end:
+  // unless a failed ring may still write to them
+  for (k = 0; k < depth && io.inflight == 0; ++k)
+    free(buf[k]);
+  free(buf);
+  free(got);
+  free(carry);
+  ohio_exit(&io);
+close:
+  if (dfd >= 0) close(dfd);
+  close(fd);
+  if (count >= 0) printCount(g, count);
+  return count;
+}
+
+
+// -z: a thread decompresses block k+1 while block k is searched
+struct unzip {
+  struct ohunz z;
+  unsigned char *buf[ZBUFS];
+  long len[ZBUFS];      // decompressed bytes, 0 at the end, -1 on error
+  int pad;
+  int full;             // blocks decompressed, not searched yet
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+static void *inflater(void *arg) {
+  struct unzip *u = (struct unzip *)arg;
+  long len;
+  int k;
+
+  for (k = 0; ; k = (k+1)%ZBUFS) {
+    pthread_mutex_lock(&u->lock);
+    while (u->full == ZBUFS)
+      pthread_cond_wait(&u->cond, &u->lock);
+    pthread_mutex_unlock(&u->lock);
+    len = ohunz_read(&u->z, u->buf[k]+u->pad, BLOCK);
+    pthread_mutex_lock(&u->lock);
+    u->len[k] = len;
+    u->full++;
+    pthread_cond_signal(&u->cond);
+    pthread_mutex_unlock(&u->lock);
+    if (len <= 0) return NULL;
+  }
+}
+
+// Returns the number of occurrences, -1 on error. Offsets are in the
+// decompressed text
+static long long searchUnzip(ohash_pattern *p, const char *name, struct grep *g) {
+  struct unzip u;
+  pthread_t tid;
+  unsigned char *carry;
+  long long count, at;
+  long len;
+  int fd, c, k;
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0) {
+    perror(name);
+    return -1;
+  }
+  memset(&u, 0, sizeof(u));
+  if (ohunz_open(&u.z, fd) < 0) {
+    fprintf(stderr, "%s: unsupported compression\n", name);
+    ohunz_close(&u.z);
+    close(fd);
+    return -1;
+  }
+  u.pad = p->m-1;
+  carry = (unsigned char *)malloc(p->m);
+  for (k = 0; k < ZBUFS; ++k) {
+    u.buf[k] = (unsigned char *)malloc(u.pad+BLOCK+p->m);
+    if (u.buf[k] == NULL) break;
+  }
+  count = -1;
+  if (carry == NULL || k < ZBUFS) {
+    fprintf(stderr, "ohgrep: out of memory\n");
+    goto end;
+  }
+  pthread_mutex_init(&u.lock, NULL);
+  pthread_cond_init(&u.cond, NULL);
+  c = pthread_create(&tid, NULL, inflater, &u);
+  if (c != 0) {
+    fprintf(stderr, "ohgrep: cannot start a thread: %s\n", strerror(c));
+    pthread_mutex_destroy(&u.lock);
+    pthread_cond_destroy(&u.cond);
+    goto end;
+  }
+
+  count = at = 0;
+  c = 0;
+  for (k = 0; ; k = (k+1)%ZBUFS) {
+    pthread_mutex_lock(&u.lock);
+    while (u.full == 0)
+      pthread_cond_wait(&u.cond, &u.lock);
+    pthread_mutex_unlock(&u.lock);
+    len = u.len[k];
+    if (len <= 0) break;
+    count += searchBlock(p, g, u.buf[k]+u.pad, len, at, carry, &c);
+    at += len;
+    pthread_mutex_lock(&u.lock);
+    u.full--;
+    pthread_cond_signal(&u.cond);
+    pthread_mutex_unlock(&u.lock);
+  }
+  // the inflater stops after the last block
+  pthread_join(tid, NULL);
+  pthread_mutex_destroy(&u.lock);
+  pthread_cond_destroy(&u.cond);
+  if (len < 0) {
+    fprintf(stderr, "%s: corrupt %s data\n", name, ohunz_name(u.z.format));
+    count = -1;
+  }
+
+end:
+  for (k = 0; k < ZBUFS; ++k)
+    free(u.buf[k]);
+  free(carry);
+  ohunz_close(&u.z);
+  close(fd);
+  if (count >= 0) printCount(g, count);
+  return count;
+}
+
+
+// -r: a file of the walk
+struct job {
+  char *name;
+  long long size;
+  int fd;
+  unsigned char *buf;   // pooled buffer, NULL if the worker maps the file
+  char *out;            // results, printed in the order of the walk
+  size_t outLen;
+  int status;           // -1 error, 0 no occurrence, 1 found
+  int done;
+  struct job *next;     // queue of the workers
+};
+
+struct tree {
+  ohash_pattern *p;
+  int mode;
+  struct job *jobs;
+  int njobs, size;
+  unsigned char **pool; // free buffers
+  int npool;
+  struct job *head, *tail;
+  int stream, depth;    // -s
+  int unzip;            // -z
+  int stop;
+  int error;            // a path could not be walked
+  pthread_mutex_t lock;
+  pthread_cond_t work;  // a job was queued
+  pthread_cond_t done;  // a job is done
+};
+
+static void addJob(struct tree *t, const char *name, long long size) {
+  struct job *j;
+
+  if (t->njobs == t->size) {
+    t->size = t->size ? 2*t->size : 256;
+    t->jobs = (struct job *)realloc(t->jobs, t->size*sizeof(struct job));
+    if (t->jobs == NULL) {
+      fprintf(stderr, "ohgrep: out of memory\n");
+      exit(2);
+    }
+  }
+  j = &t->jobs[t->njobs++];
+  memset(j, 0, sizeof(*j));
+  j->name = strdup(name);
+  j->size = size;
+  j->fd = -1;
+}
+
+// Collects the regular files under path, symbolic links are not followed
+static void walk(struct tree *t, const char *path) {
+  struct dirent *e;
+  struct stat st;
+  char *sub;
+  DIR *d;
+
+  if (lstat(path, &st) < 0) {
+    perror(path);
+    t->error = 1;
+    return;
+  }
+  if (S_ISREG(st.st_mode)) {
+    addJob(t, path, st.st_size);
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) return;
+  d = opendir(path);
+  if (d == NULL) {
+    perror(path);
+    t->error = 1;
+    return;
+  }
+  while ((e = readdir(d)) != NULL) {
+    if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+    sub = (char *)malloc(strlen(path)+strlen(e->d_name)+2);
+    sprintf(sub, "%s/%s", path, e->d_name);
+    walk(t, sub);
+    free(sub);
+  }
+  closedir(d);
+}
+
+static void runJob(struct tree *t, struct job *j) {
+  struct grep g;
+  long long count;
+
+  memset(&g, 0, sizeof(g));
+  g.out = open_memstream(&j->out, &j->outLen);
+  g.name = j->name;
+  g.mode = t->mode;
+  if (j->buf != NULL) {
+    g.text = j->buf;
+    g.size = j->size;
+    if (t->mode == MODE_COUNT)
+      count = ohash_exec(t->p, j->buf, j->size);
+    else
+      count = searchText(t->p, &g);
+    printCount(&g, count);
+  }
+  else if (t->unzip) {
+    count = searchUnzip(t->p, j->name, &g);
+  }
+  else if (t->stream && t->mode != MODE_LINES) {
+    g.depth = t->depth;
+    count = searchStream(t->p, j->name, &g);
+  }
+  else {
+    count = searchFile(t->p, j->name, &g);
+  }
+  fclose(g.out);
+  j->status = count < 0 ? -1 : count > 0;
+}
+
+static void *worker(void *arg) {
+  struct tree *t = (struct tree *)arg;
+  struct job *j;
+
+  while (1) {
+    pthread_mutex_lock(&t->lock);
+    while (t->head == NULL && !t->stop)
+      pthread_cond_wait(&t->work, &t->lock);
+    j = t->head;
+    if (j == NULL) {
+      pthread_mutex_unlock(&t->lock);
+      return NULL;
+    }
+    t->head = j->next;
+    if (t->head == NULL) t->tail = NULL;
+    pthread_mutex_unlock(&t->lock);
+
+    runJob(t, j);
+
+    pthread_mutex_lock(&t->lock);
+    if (j->buf != NULL) t->pool[t->npool++] = j->buf;
+    j->buf = NULL;
+    j->done = 1;
+    pthread_cond_signal(&t->done);
+    pthread_mutex_unlock(&t->lock);
+  }
+}
+
+// Called with the lock held
+static void queueJob(struct tree *t, struct job *j) {
+  j->next = NULL;
+  if (t->tail != NULL) t->tail->next = j;
+  else t->head = j;
+  t->tail = j;
+  pthread_cond_signal(&t->work);
+}
+
+// The main thread keeps up to depth reads in flight, hands the files
+// read to the workers and prints the results in order
+static int searchTree(ohash_pattern *p, struct grep *g, char **paths, int npaths, int threads) {
+  struct tree t;
+  struct ohio io;
+  struct job *j;
+  pthread_t *tid;
+  void *tag;
+  int i, next, printed, res, found, error, progress, depth, started;
+
+  memset(&t, 0, sizeof(t));
+  t.p = p;
+  t.mode = g->mode;
+  t.stream = g->stream;
+  t.unzip = g->unzip;
+  t.depth = depth = g->depth;
+  for (i = 0; i < npaths; ++i)
+    walk(&t, paths[i]);
+  next = printed = found = started = 0;
+  error = t.error;
+  tid = NULL;
+  if (ohio_init(&io, depth) < 0) {
+    fprintf(stderr, "ohgrep: out of memory\n");
+    error = 1;
+    goto end;
+  }
+  t.pool = (unsigned char **)malloc(depth*sizeof(unsigned char *));
+  for (i = 0; t.pool != NULL && i < depth; ++i) {
+    t.pool[i] = (unsigned char *)malloc(POOL_BUF+p->m);
+    if (t.pool[i] == NULL) break;
+  }
+  t.npool = i;
+  tid = (pthread_t *)malloc(threads*sizeof(pthread_t));
+  if (t.npool == 0 || tid == NULL) {
+    fprintf(stderr, "ohgrep: out of memory\n");
+    error = 1;
+    goto release;
+  }
+  pthread_mutex_init(&t.lock, NULL);
+  pthread_cond_init(&t.work, NULL);
+  pthread_cond_init(&t.done, NULL);
+  for (started = 0; started < threads; ++started) {
+    res = pthread_create(&tid[started], NULL, worker, &t);
+    if (res != 0) {
+      fprintf(stderr, "ohgrep: cannot start a thread: %s\n", strerror(res));
+      error = 1;
+      goto stop;
+    }
+  }
+
+  while (printed < t.njobs) {
+    progress = 0;
+    pthread_mutex_lock(&t.lock);
+    while (next < t.njobs) {
+      j = &t.jobs[next];
+      if (j->size > POOL_BUF || t.unzip) {
+        queueJob(&t, j);
+      }
+      else {
+        if (t.npool == 0) break;
+        j->fd = open(j->name, O_RDONLY);
+        if (j->fd < 0) {
+          perror(j->name);
+          j->status = -1;
+          j->done = 1;
+        }
+        else {
+          j->buf = t.pool[--t.npool];
+          if (ohio_read(&io, j->fd, j->buf, (unsigned)j->size, 0, j) < 0) {
+            t.pool[t.npool++] = j->buf;
+            j->buf = NULL;
+            close(j->fd);
+            break;
+          }
+        }
+      }
+      ++next;
+      progress = 1;
+    }
+    pthread_mutex_unlock(&t.lock);
+
+    ohio_submit(&io);
+    if (io.inflight > 0) {
+      res = ohio_wait(&io, &tag);
+      if (tag == NULL) {
+        // the reads still in the ring keep their buffers
+        fprintf(stderr, "ohgrep: %s\n", strerror(-res));
+        error = 1;
+        goto stop;
+      }
+      j = (struct job *)tag;
+      close(j->fd);
+      pthread_mutex_lock(&t.lock);
+      if (res < 0) {
+        fprintf(stderr, "%s: %s\n", j->name, strerror(-res));
+        t.pool[t.npool++] = j->buf;
+        j->buf = NULL;
+        j->status = -1;
+        j->done = 1;
+      }
+      else {
+        j->size = res;
+        queueJob(&t, j);
+      }
+      pthread_mutex_unlock(&t.lock);
+      progress = 1;
+    }
+
+    pthread_mutex_lock(&t.lock);
+    while (printed < t.njobs && t.jobs[printed].done) {
+      j = &t.jobs[printed++];
+      if (j->out != NULL) fwrite(j->out, 1, j->outLen, stdout);
+      free(j->out);
+      free(j->name);
+      if (j->status < 0) error = 1;
+      else if (j->status > 0) found = 1;
+      progress = 1;
+    }
+    if (!progress)
+      pthread_cond_wait(&t.done, &t.lock);
+    pthread_mutex_unlock(&t.lock);
+  }
+
+stop:
+  pthread_mutex_lock(&t.lock);
+  t.stop = 1;
+  pthread_cond_broadcast(&t.work);
+  pthread_mutex_unlock(&t.lock);
+  for (i = 0; i < started; ++i)
+    pthread_join(tid[i], NULL);
+  pthread_mutex_destroy(&t.lock);
+  pthread_cond_destroy(&t.work);
+  pthread_cond_destroy(&t.done);
+release:
+  for (i = 0; i < t.npool; ++i)
+    free(t.pool[i]);
+  free(t.pool);
+  free(tid);
+  ohio_exit(&io);
+end:
+  // the jobs not printed when stopping early
+  for (i = printed; i < t.njobs; ++i) {
+    free(t.jobs[i].out);
+    free(t.jobs[i].name);
+  }
+  free(t.jobs);
+  return error ? 2 : found ? 0 : 1;
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: ohgrep [-c [-N] | -b] [-r] [-j threads] [-s | -z] [-Q depth]\n"
+                  "              [-S strategy] [-K] pattern file...\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  ohash_pattern *p;
+  struct ohash_par par;
+  struct grep g;
+  long long r;
+  int c, strategy, kernel, recursive, threads, found, error, i;
+  char buf[32];
+
+  memset(&g, 0, sizeof(g));
+  g.out = stdout;
+  g.mode = MODE_LINES;
+  strategy = OHASH_AUTO;
+  kernel = recursive = 0;
+  threads = sysconf(_SC_NPROCESSORS_ONLN);
+  g.depth = 64;
+  while ((c = getopt(argc, argv, "cNbrj:szQ:S:K")) != -1) {
+    switch (c) {
+      case 'c' :
+        g.mode = MODE_COUNT;
+        break;
+      case 'N' :
+        g.nodes = 1;
+        break;
+      case 'b' :
+        g.mode = MODE_OFFSETS;
+        break;
+      case 'r' :
+        recursive = 1;
+        break;
+      case 'j' :
+        threads = atoi(optarg);
+        break;
+      case 's' :
+        g.stream = 1;
+        break;
+      case 'z' :
+        g.unzip = 1;
+        break;
+      case 'Q' :
+        g.depth = atoi(optarg);
+        break;
+      case 'S' :
+        strategy = atoi(optarg);
+        if (strategy < OHASH_1 || strategy > OHASH_RARE) usage();
+        break;
+      case 'K' :
+        kernel = 1;
+        break;
+      default :
+        usage();
+    }
+  }
+  if (argc-optind < 2 || argv[optind][0] == '\0' || threads < 1 || g.depth < 1) usage();
+  // a line may span any number of blocks
+  if (g.unzip && g.mode == MODE_LINES) usage();
+
+  p = ohash_compile((unsigned char *)argv[optind], strlen(argv[optind]), strategy);
+  if (p == NULL) {
+    fprintf(stderr, "ohgrep: out of memory\n");
+    return 2;
+  }
+  if (kernel)
+    fprintf(stderr, "ohgrep: strategy %d, kernel %s, %s\n", p->strategy,
+            ohash_kernel_name(p, buf, sizeof(buf)), ohash_isa());
+
+  if (recursive) {
+    i = searchTree(p, &g, argv+optind+1, argc-optind-1, threads);
+    ohash_free(p);
+    return i;
+  }
+
+  if (g.mode == MODE_COUNT && (threads > 1 || g.nodes)) {
+    if (ohash_par_init(&par, threads) == 0) g.par = &par;
+  }
+  found = error = 0;
+  for (i = optind+1; i < argc; ++i) {
+    g.name = argc-optind > 2 ? argv[i] : NULL;
+    if (g.unzip)
+      r = searchUnzip(p, argv[i], &g);
+    else if (g.stream && g.mode != MODE_LINES)
+      r = searchStream(p, argv[i], &g);
+    else
+      r = searchFile(p, argv[i], &g);
+    if (r < 0) error = 1;
+    else if (r > 0) found = 1;
+  }
+  if (g.par != NULL) ohash_par_exit(g.par);
+  ohash_free(p);
+  return error ? 2 : found ? 0 : 1;
+}